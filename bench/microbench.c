@@ -0,0 +1,329 @@
+/*
+ * microbench.c - Microbenchmarks of the client-side hot paths
+ * of pg_reindex on synthetic catalog-sized inputs, no database
+ * is needed. Run by "make microbench".
+ *
+ * Allocations are counted by linking with -Wl,--wrap=malloc
+ * (and calloc, realloc), so only calls made by pg_reindex code
+ * are seen, not the ones inside libc or libpq.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <libpq-fe.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../headers/logging.h"
+#include "../headers/textutil.h"
+
+// Synthetic catalog size and the file buffer of rebuild_from_file():
+#define N_IDX 100000
+#define LINE_BUFSIZE 68
+#define PRINT_ROWS 10000
+
+struct bench_t {
+	const char *name;
+	long ops;
+	double ns;
+	long allocs;
+};
+
+static long n_allocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	n_allocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+	n_allocs++;
+	return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	n_allocs++;
+	return __real_realloc(ptr, size);
+}
+
+static char *idx_names[N_IDX];
+static char *idx_defs[N_IDX];
+
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+// gen_catalog(): index names and definitions in the shapes
+// pg_indexes.indexdef has: plain, unique, partial, with storage
+// parameters, multicolumn and expression indexes
+static void gen_catalog(void)
+{
+	char buf[512];
+	int i;
+
+	for (i = 0; i < N_IDX; i++) {
+		snprintf(buf, sizeof(buf), "idx_orders_%d_customer_id", i);
+		idx_names[i] = strdup(buf);
+
+		switch (i % 5) {
+			case 0:
+				snprintf(buf, sizeof(buf),
+					 "CREATE INDEX %s ON public.orders_%d "
+					 "USING btree (customer_id)",
+					 idx_names[i], i);
+				break;
+			case 1:
+				snprintf(buf, sizeof(buf),
+					 "CREATE UNIQUE INDEX %s ON public.orders_%d "
+					 "USING btree (customer_id, created_at)",
+					 idx_names[i], i);
+				break;
+			case 2:
+				snprintf(buf, sizeof(buf),
+					 "CREATE INDEX %s ON public.orders_%d "
+					 "USING btree (status) WHERE (status <> "
+					 "'done'::text)", idx_names[i], i);
+				break;
+			case 3:
+				snprintf(buf, sizeof(buf),
+					 "CREATE INDEX %s ON public.orders_%d "
+					 "USING btree (customer_id) WITH "
+					 "(fillfactor='90', deduplicate_items=off)",
+					 idx_names[i], i);
+				break;
+			default:
+				snprintf(buf, sizeof(buf),
+					 "CREATE INDEX %s ON public.orders_%d "
+					 "USING gin (lower(comment) gin_trgm_ops)",
+					 idx_names[i], i);
+		}
+		idx_defs[i] = strdup(buf);
+	}
+}
+
+
+static void bench_begin(struct bench_t *b, const char *name, long ops)
+{
+	b->name = name;
+	b->ops = ops;
+	b->allocs = n_allocs;
+	b->ns = now_ns();
+}
+
+
+static void bench_end(struct bench_t *b)
+{
+	b->ns = now_ns() - b->ns;
+	b->allocs = n_allocs - b->allocs;
+
+	printf("%-24s %10ld ops %12.1f ns/op %8.2f allocs/op\n",
+	       b->name, b->ops, b->ns / b->ops,
+	       (double)b->allocs / b->ops);
+}
+
+
+// bench_log_write(): a typical line of the rebuild log
+static void bench_log_write(FILE *devnull)
+{
+	struct bench_t b;
+	int i;
+
+	bench_begin(&b, "log_write", N_IDX);
+
+	for (i = 0; i < N_IDX; i++)
+		log_write(devnull, INF,
+			  "Index %s: %ld bytes, %d%% bloat, %f ms\n",
+			  idx_names[i], (long)i * 8192, i % 100, i / 7.0);
+
+	bench_end(&b);
+}
+
+
+static void bench_creat_cmd(void)
+{
+	struct bench_t b;
+	char *new_iname, *cmd;
+	int i;
+
+	bench_begin(&b, "make_creat_cmd", N_IDX);
+
+	for (i = 0; i < N_IDX; i++) {
+		new_iname = make_new_iname(idx_names[i]);
+		cmd = make_creat_cmd(new_iname, idx_defs[i]);
+		free(cmd);
+		free(new_iname);
+	}
+
+	bench_end(&b);
+}
+
+
+static void bench_fillfactor(void)
+{
+	struct bench_t b;
+	char **cmds;
+	int i;
+
+	// set_fillfactor() frees the passed command, copy them first:
+	cmds = (char**)malloc(N_IDX * sizeof(char*));
+	for (i = 0; i < N_IDX; i++)
+		cmds[i] = strdup(idx_defs[i]);
+
+	bench_begin(&b, "set_fillfactor", N_IDX);
+
+	for (i = 0; i < N_IDX; i++)
+		cmds[i] = set_fillfactor(cmds[i], 70 + i % 30);
+
+	bench_end(&b);
+
+	for (i = 0; i < N_IDX; i++)
+		free(cmds[i]);
+	free(cmds);
+}
+
+
+// bench_idx_list(): read a 100k-line -f file the way
+// rebuild_from_file() does, with fgets() into 68 bytes
+static void bench_idx_list(void)
+{
+	struct bench_t b;
+	char buf[LINE_BUFSIZE];
+	FILE *fp;
+	long n = 0;
+	int i;
+
+	if ((fp = tmpfile()) == NULL) {
+		perror("tmpfile");
+		return;
+	}
+
+	for (i = 0; i < N_IDX; i++) {
+		if (i % 50 == 0)
+			fprintf(fp, "# batch %d\n\n", i / 50);
+		fprintf(fp, "%s\n", idx_names[i]);
+	}
+
+	rewind(fp);
+	bench_begin(&b, "index list (fgets)", N_IDX);
+
+	while (fgets(buf, sizeof(buf), fp) != NULL)
+		if (parse_idx_line(buf))
+			n++;
+
+	bench_end(&b);
+
+	if (n != N_IDX)
+		fprintf(stderr, "index list: %ld names of %d read\n",
+			n, N_IDX);
+	fclose(fp);
+}
+
+
+static void bench_format_size(void)
+{
+	struct bench_t b;
+	char buf[32];
+	long i;
+
+	bench_begin(&b, "format_size", N_IDX);
+
+	for (i = 0; i < N_IDX; i++)
+		format_size(i * i * 977, buf, sizeof(buf));
+
+	bench_end(&b);
+}
+
+
+// bench_print_result(): PQprint() of a synthetic -s result,
+// the rows are made by PQmakeEmptyPGresult() and PQsetvalue()
+static void bench_print_result(FILE *devnull)
+{
+	static char *cols[] = {"index_name", "index_size",
+			       "bloat_size", "bloat_pct"};
+	PGresAttDesc attrs[4];
+	PQprintOpt opt = {0};
+	PGresult *res;
+	struct bench_t b;
+	char buf[32];
+	int i, j;
+
+	res = PQmakeEmptyPGresult(NULL, PGRES_TUPLES_OK);
+	memset(attrs, 0, sizeof(attrs));
+
+	for (j = 0; j < 4; j++) {
+		attrs[j].name = cols[j];
+		attrs[j].typid = 25;
+		attrs[j].typlen = -1;
+		attrs[j].atttypmod = -1;
+	}
+
+	if (!res || !PQsetResultAttrs(res, 4, attrs)) {
+		fprintf(stderr, "Could not make a PGresult\n");
+		PQclear(res);
+		return;
+	}
+
+	for (i = 0; i < PRINT_ROWS; i++) {
+		PQsetvalue(res, i, 0, idx_names[i], -1);
+		format_size((long)i * 81920, buf, sizeof(buf));
+		PQsetvalue(res, i, 1, buf, -1);
+		format_size((long)i * 20480, buf, sizeof(buf));
+		PQsetvalue(res, i, 2, buf, -1);
+		snprintf(buf, sizeof(buf), "%d", i % 100);
+		PQsetvalue(res, i, 3, buf, -1);
+	}
+
+	opt.header = 1;
+	opt.align = 1;
+	opt.fieldSep = "|";
+
+	bench_begin(&b, "PQprint (per row)", PRINT_ROWS);
+	PQprint(devnull, res, &opt);
+	bench_end(&b);
+
+	PQclear(res);
+}
+
+
+int main(void)
+{
+	FILE *devnull;
+	int i;
+
+	if ((devnull = fopen("/dev/null", "w")) == NULL) {
+		perror("/dev/null");
+		return 1;
+	}
+
+	gen_catalog();
+
+	printf("Synthetic catalog of %d indexes\n", N_IDX);
+	bench_log_write(devnull);
+	bench_creat_cmd();
+	bench_fillfactor();
+	bench_idx_list();
+	bench_format_size();
+	bench_print_result(devnull);
+
+	for (i = 0; i < N_IDX; i++) {
+		free(idx_names[i]);
+		free(idx_defs[i]);
+	}
+
+	fclose(devnull);
+	return 0;
+}
@@ -6,6 +6,12 @@
 #define SUCCESS 1
 #define FAIL 0
 
+// Returned by catalog helpers when the query fails:
+#define QUERY_ERR -2
+
+// Returned by reconcile_idx() when it finished a swap:
+#define SWAPPED 2
+
 #define VERSION "1.1.3"
 
 // Default statement timeout:
@@ -14,9 +20,172 @@
 // Default log file:
 #define LOG_FILE "/tmp/pg_reindex.log"
 
+// Lock-queue watchdog defaults (see --watchdog):
+#define WD_MAX_BLOCKED 3	// sessions queued behind our lock
+#define WD_MAX_BLOCK_MS 200	// longest wait of a queued session
+#define WD_INTERVAL_MS 10	// pg_blocking_pids() poll interval
+#define WD_RETRIES 5		// attempts after a cancelled statement
+#define WD_RETRY_DELAY_MS 1000	// pause before the first retry
+#define WD_MAX_PIDS 64		// queued sessions tracked before PG 14
+
+// Session queued behind our lock and when it was seen first:
+struct wd_pid_t {
+	int pid;
+	double since;
+};
+
+// Daemon mode defaults (see --daemon):
+#define DMN_POLL_MS 1000	// wakeup interval of the socket loop
+#define DMN_CMD_BUFSIZE 256	// max length of a control command
+#define DMN_HISTORY 20		// finished jobs kept for STATUS
+
+// Sampled bloat estimator defaults (see --sample-bloat):
+#define SMP_BATCH 32		// pages read per query
+#define SMP_MIN_PAGES 64	// minimal sample of one index
+#define SMP_CI 2.0		// target CI half-width, % of the index
+#define SMP_MAX_PCT 1.0		// max pages read, % of the index
+
+// Latency probe defaults (see --probe):
+#define PRB_RATE 10		// probe queries per second
+#define PRB_BASELINE_SEC 5	// baseline measured before rebuilding
+
+// Adaptive fillfactor (see --auto-fillfactor):
+#define HISTORY_FILE "/tmp/pg_reindex.history"
+#define BUILD_STARTED -1	// history size of a new_ index being built
+#define BUILD_ENDED -2		// the new_ index is swapped or dropped
+#define FF_TARGET_DAYS 30	// wanted time between rebuilds
+#define FF_MIN 50
+#define FF_MAX 90		// the btree default, never pack tighter
+#define FF_MONOTONIC 0.95	// correlation of an ever-increasing key
+
+// Heat-based tablespace relocation (see --ts-hot, --ts-cold):
+#define TS_HOT_SCANS 100	// scans per second of a hot index
+#define TS_HOT_READS 10		// blocks read from disk per second
+#define TS_COLD_SCANS 0.01	// scans per second of a cold index
+#define TS_RESERVE 1.2		// free space needed, times the old size
+
+// Transactions that stall CREATE INDEX CONCURRENTLY:
+#define XACT_MAX_AGE 300	// sec, older transactions block the build
+#define XACT_DEFER_MAX 1800	// sec to wait for them to finish
+#define XACT_POLL_MS 1000	// interval of in-flight checks
+
+enum { XACT_WARN, XACT_DEFER, XACT_TERMINATE };
+
+// Unused indexes across the primary and standbys (see --standby):
+#define USAGE_FILE "/tmp/pg_reindex.usage"
+#define MAX_STANDBYS 16
+
+// Dead tuples in % of the table to VACUUM it after rebuilding:
+#define VAC_DEAD_PCT 20
+
+// Tracks of --trace, one per connection:
+enum { TRK_MAIN = 1, TRK_MON, TRK_VER };
+#define TRACE_SAMPLE_MS 100	// wait event sampling interval
+
+// Sharded bloat scan of -s (see --jobs, --top, --schema):
+#define MAX_JOBS 32		// connections of the scan
+#define BLOAT_TOP 50		// indexes in the report
+#define BLOAT_SCHEMA "^public$"	// schemas of the report
+
+// Replay lag of the --analyze-host standby to trust its results:
+#define ANA_MAX_LAG 60		// sec
+
+// Returned by swap commands cancelled by the watchdog:
+#define CANCELED -1
+
 // Allowable command-line arguments:
 static const char *opt_string = "d:r:f:u:l:t:nsihv";
 
+// Codes of long-only command-line arguments:
+enum {
+	OPT_WATCHDOG = 256,
+	OPT_MAX_BLOCKED,
+	OPT_MAX_BLOCK_MS,
+	OPT_SWAP_RETRIES,
+	OPT_PREWARM,
+	OPT_PREWARM_BUDGET,
+	OPT_DAEMON,
+	OPT_SCAN_INTERVAL,
+	OPT_SAMPLE_BLOAT,
+	OPT_SAMPLE_CI,
+	OPT_SAMPLE_MAX,
+	OPT_VERIFY,
+	OPT_PROBE,
+	OPT_PROBE_RATE,
+	OPT_PROBE_BASELINE,
+	OPT_AUTO_FILLFACTOR,
+	OPT_HISTORY,
+	OPT_TS_HOT,
+	OPT_TS_COLD,
+	OPT_HOT_SCANS,
+	OPT_HOT_READS,
+	OPT_COLD_SCANS,
+	OPT_RECONCILE,
+	OPT_XACT_POLICY,
+	OPT_XACT_MAX_AGE,
+	OPT_DEFER_MAX,
+	OPT_MIN_GAIN,
+	OPT_HEALTH,
+	OPT_ANALYZE_HOST,
+	OPT_MAX_LAG,
+	OPT_POST_ANALYZE,
+	OPT_VACUUM_DEAD,
+	OPT_STANDBY,
+	OPT_USAGE_FILE,
+	OPT_UNUSED_DAYS,
+	OPT_TRACE,
+	OPT_OBSERVE,
+	OPT_JOBS,
+	OPT_TOP,
+	OPT_SCHEMA,
+	OPT_EXCL_SCHEMA,
+};
+
+static const struct option long_opts[] = {
+	{"watchdog",		no_argument,		NULL, OPT_WATCHDOG},
+	{"max-blocked",		required_argument,	NULL, OPT_MAX_BLOCKED},
+	{"max-block-ms",	required_argument,	NULL, OPT_MAX_BLOCK_MS},
+	{"swap-retries",	required_argument,	NULL, OPT_SWAP_RETRIES},
+	{"prewarm",		no_argument,		NULL, OPT_PREWARM},
+	{"prewarm-budget",	required_argument,	NULL, OPT_PREWARM_BUDGET},
+	{"daemon",		required_argument,	NULL, OPT_DAEMON},
+	{"scan-interval",	required_argument,	NULL, OPT_SCAN_INTERVAL},
+	{"sample-bloat",	no_argument,		NULL, OPT_SAMPLE_BLOAT},
+	{"sample-ci",		required_argument,	NULL, OPT_SAMPLE_CI},
+	{"sample-max",		required_argument,	NULL, OPT_SAMPLE_MAX},
+	{"verify",		no_argument,		NULL, OPT_VERIFY},
+	{"probe",		required_argument,	NULL, OPT_PROBE},
+	{"probe-rate",		required_argument,	NULL, OPT_PROBE_RATE},
+	{"probe-baseline",	required_argument,	NULL, OPT_PROBE_BASELINE},
+	{"auto-fillfactor",	no_argument,		NULL, OPT_AUTO_FILLFACTOR},
+	{"history",		required_argument,	NULL, OPT_HISTORY},
+	{"ts-hot",		required_argument,	NULL, OPT_TS_HOT},
+	{"ts-cold",		required_argument,	NULL, OPT_TS_COLD},
+	{"hot-scans",		required_argument,	NULL, OPT_HOT_SCANS},
+	{"hot-reads",		required_argument,	NULL, OPT_HOT_READS},
+	{"cold-scans",		required_argument,	NULL, OPT_COLD_SCANS},
+	{"reconcile",		no_argument,		NULL, OPT_RECONCILE},
+	{"xact-policy",		required_argument,	NULL, OPT_XACT_POLICY},
+	{"xact-max-age",	required_argument,	NULL, OPT_XACT_MAX_AGE},
+	{"defer-max",		required_argument,	NULL, OPT_DEFER_MAX},
+	{"min-gain",		required_argument,	NULL, OPT_MIN_GAIN},
+	{"health",		no_argument,		NULL, OPT_HEALTH},
+	{"analyze-host",	required_argument,	NULL, OPT_ANALYZE_HOST},
+	{"max-lag",		required_argument,	NULL, OPT_MAX_LAG},
+	{"post-analyze",	no_argument,		NULL, OPT_POST_ANALYZE},
+	{"vacuum-dead",		required_argument,	NULL, OPT_VACUUM_DEAD},
+	{"standby",		required_argument,	NULL, OPT_STANDBY},
+	{"usage-file",		required_argument,	NULL, OPT_USAGE_FILE},
+	{"unused-days",		required_argument,	NULL, OPT_UNUSED_DAYS},
+	{"trace",		required_argument,	NULL, OPT_TRACE},
+	{"observe",		required_argument,	NULL, OPT_OBSERVE},
+	{"jobs",		required_argument,	NULL, OPT_JOBS},
+	{"top",			required_argument,	NULL, OPT_TOP},
+	{"schema",		required_argument,	NULL, OPT_SCHEMA},
+	{"exclude-schema",	required_argument,	NULL, OPT_EXCL_SCHEMA},
+	{NULL, 0, NULL, 0}
+};
+
 // Global arguments struct:
 struct glob_args_t {
 	char *db_name;		// -d param
@@ -28,22 +197,273 @@ struct glob_args_t {
 	int new_pref;		// -n
 	int stat;		// -s
 	int inval;		// -i
+	int watchdog;		// --watchdog
+	int max_blocked;	// --max-blocked param
+	int max_block_ms;	// --max-block-ms param
+	int swap_retries;	// --swap-retries param
+	int prewarm;		// --prewarm
+	long prewarm_budget;	// --prewarm-budget param
+	char *sock_path;	// --daemon param
+	int scan_interval;	// --scan-interval param
+	int sample;		// --sample-bloat
+	double sample_ci;	// --sample-ci param
+	double sample_max;	// --sample-max param
+	int verify;		// --verify
+	char *probe_sql;	// --probe param
+	int probe_rate;		// --probe-rate param
+	int probe_baseline;	// --probe-baseline param
+	int auto_ff;		// --auto-fillfactor
+	char *history;		// --history param
+	char *ts_hot;		// --ts-hot param
+	char *ts_cold;		// --ts-cold param
+	double hot_scans;	// --hot-scans param
+	double hot_reads;	// --hot-reads param
+	double cold_scans;	// --cold-scans param
+	int reconcile;		// --reconcile param
+	int xact_policy;	// --xact-policy param
+	int xact_max_age;	// --xact-max-age param
+	int defer_max;		// --defer-max param
+	long min_gain;		// --min-gain param in bytes
+	double min_gain_pct;	// --min-gain param in %
+	int health;		// --health param
+	char *ana_host;		// --analyze-host param
+	int max_lag;		// --max-lag param
+	int post_analyze;	// --post-analyze param
+	double vacuum_dead;	// --vacuum-dead param
+	char *standbys[MAX_STANDBYS];	// --standby params
+	int n_standbys;
+	char *usage_file;	// --usage-file param
+	int unused_days;	// --unused-days param
+	char *trace_file;	// --trace param
+	int observe;		// --observe param
+	int jobs;		// --jobs param
+	int top;		// --top param
+	char *schema;		// --schema param
+	char *excl_schema;	// --exclude-schema param
 } glob_args;
 
+// Phases of the index rebuild:
+enum { PH_PREPARE, PH_BUILD, PH_VERIFY, PH_SWAP, PH_COUNT };
+
+static const char *phase_names[] = {"prepare", "build", "verify", "swap"};
+
+// Probe latencies are kept per rebuild phase, for the baseline
+// before rebuilding and for time between phases:
+enum { PRB_BASELINE = PH_COUNT, PRB_IDLE, PRB_COUNT };
+
+static const char *probe_phase_names[] = {"prepare", "build", "verify",
+					  "swap", "baseline", "idle"};
+
+// Scans and block reads of the index from
+// pg_stat_user_indexes and pg_statio_user_indexes:
+struct io_stat_t {
+	long idx_scan;
+	long blks_read;
+	long blks_hit;
+};
+
+// State of one index rebuild passed between the phases:
+struct rebuild_t {
+	char iname[68];
+	char *new_iname;
+	char *indexdef;
+	char *idx_comment;
+	char *idx_am;
+	int fillfactor;			// chosen fillfactor, 0 if kept
+	char *tablespace;		// of the new index, NULL if default
+	char contype;			// 'p' or 'u' if backs a constraint
+	long prev_size;
+	int verify_sent;
+	int done;			// the new index is in place
+	long reclaimed;			// prev - new size in bytes
+	long pred_gain;			// estimated before, -1 if unknown
+	int skipped;			// the gain is below --min-gain
+	double snap_wait_ms;		// build time waiting for old snapshots
+	char *tbl_name;			// the table of the index
+	int io_known;			// io_before and io_base are taken
+	struct io_stat_t io_before;	// of the previous index at the swap
+	struct io_stat_t io_base;	// of the new index at the swap
+	double phase_start[PH_COUNT];
+	double phase_ms[PH_COUNT];	// -1 if the phase is not passed
+	long wal_start[PH_COUNT];	// WAL position at the phase start
+	long wal_bytes[PH_COUNT];	// -1 if unknown
+};
+
+// Scans of the index on the primary by its oid:
+struct idx_usage_t {
+	long oid;
+	long idx_scan;
+};
+
+// Cumulative scans of the index on one server, kept in
+// the usage file across statistic resets:
+struct usage_rec_t {
+	char db[68];
+	char node[128];
+	long oid;
+	long last_scan;		// idx_scan at the last check
+	long total;		// scans since first_seen
+	long last_used;		// when total grew, 0 if never
+	long first_seen;
+};
+
+// Bloated index of the health snapshot:
+struct health_row_t {
+	int row;
+	long bloat;
+};
+
+// Bloated btree index of the -s report:
+struct bloat_row_t {
+	char nsp[68];
+	char tbl[68];
+	char idx[68];
+	char ratio[16];
+	long size;
+	long bloat;
+};
+
+// Min-heap of the most bloated indexes over all shards,
+// the least bloated of the top is rows[0]:
+struct bloat_heap_t {
+	struct bloat_row_t *rows;
+	int n;
+	int max;
+};
+
+// I/O of the rebuilt index watched for --observe seconds:
+struct io_obs_t {
+	char iname[68];
+	struct io_stat_t before;
+	struct io_stat_t base;
+	double swap_ms;			// the end of the swap
+};
+
+// Totals of rebuilding indexes from a file:
+struct batch_stat_t {
+	int done;
+	int failed;
+	long wal_bytes;
+	int skipped;
+	long reclaimed;
+	long predicted;		// estimated gain of the done ones
+	long pred_actual;	// reclaimed by the ones with estimate
+	double snap_wait_ms;
+	char **tables;		// rebuilt tables for --post-analyze
+	int n_tables;
+	struct io_obs_t *obs;	// rebuilt indexes for --observe
+	int n_obs;
+};
+
+// Daemon job types and states:
+enum { JOB_REBUILD, JOB_SCAN };
+enum { JOB_QUEUED, JOB_RUNNING, JOB_DONE, JOB_FAILED };
+
+// Job accepted by the daemon:
+struct dmn_job_t {
+	int id;
+	int type;
+	int state;
+	char db_name[64];
+	char idx_name[64];
+	time_t queued;
+	time_t started;
+	time_t finished;
+	struct dmn_job_t *next;
+};
+
+// Pooled connections of one database:
+struct dmn_pool_t {
+	char db_name[64];
+	char *conninfo;
+	PGconn *conn;
+	PGconn *mon;
+	time_t last_scan;
+	struct dmn_pool_t *next;
+};
+
 // Wrap function for parsing cli args:
 static void get_opts(int argc, char **argv);
 
 // File ptr for logging:
 FILE* log_fp;
 
+// Connection string of the main connection:
+char *db_conninfo;
+
+// Second connection for monitoring the main one:
+PGconn *mon_conn;
+
+// Connection for verification of new indexes:
+PGconn *ver_conn;
+
+// Standby connection for read-only analysis:
+PGconn *ana_conn;
+
 // Stat functions:
-static void print_bloat_stat(PGconn *conn);
+static int print_bloat_stat(PGconn *conn);
+
+static int print_invalid_idx(PGconn *conn);
+
+static int print_not_used_idx(PGconn *conn, char *s, char *t);
+
+static int show_new_pref_idx(PGconn *conn);
+
+static int print_sampled_bloat(PGconn *conn);
+
+static int print_am_bloat(PGconn *conn);
+
+PGconn *clone_conn(PGconn *conn);
+
+int run_bloat_shards(PGconn **conns, int n, struct bloat_heap_t *heap);
+
+void bloat_heap_push(struct bloat_heap_t *heap, struct bloat_row_t *row);
+
+int cmp_bloat_row(const void *a, const void *b);
+
+void print_bloat_rows(struct bloat_heap_t *heap);
+
+static int print_unused_agg(PGconn *conn, char *threshold);
 
-static void print_invalid_idx(PGconn *conn);
+int collect_usage(PGconn *conn, char *db, struct usage_rec_t **recs,
+		  int *n, long now);
 
-static void print_not_used_idx(PGconn *conn, char *s, char *t);
+struct usage_rec_t *get_usage_rec(struct usage_rec_t **recs, int *n,
+				  int n_sorted, char *db, char *node, long oid);
 
-static void show_new_pref_idx(PGconn *conn);
+int cmp_usage_oid(const void *a, const void *b);
+
+int cmp_usage_rec(const void *a, const void *b);
+
+int load_usage(struct usage_rec_t **recs, int *n);
+
+void save_usage(struct usage_rec_t *recs, int n);
+
+static int print_health(PGconn *aconn, PGconn *conn);
+
+PGconn *get_ana_conn(PGconn *conn);
+
+double get_replay_lag(PGconn *conn);
+
+int cmp_idx_usage(const void *a, const void *b);
+
+static void print_health_idx(PGresult *res, int row);
+
+int cmp_health_row(const void *a, const void *b);
+
+
+PGresult *get_sample_idx(PGconn *conn, char *ams);
+
+int sample_idx_bloat(PGconn *conn, char *oid, char *am, long nblocks,
+		     int fillfactor, double *bloat, double *ci, double *fill,
+		     long *sampled);
+
+long get_gin_pending(PGconn *conn, char *oid);
+
+int get_brin_coverage(PGconn *conn, char *oid, long tbl_nblocks,
+		      long *summarized, long *ranges);
+
+long rand_block(long nblocks);
 
 // Primary functions:
 static void exit_nicely(PGconn *conn);
@@ -52,17 +472,103 @@ int check_idx_name(PGconn *conn, char *iname);
 
 int check_idx_validity(PGconn *conn, char *iname);
 
+char *get_idx_am(PGconn *conn, char *iname);
+
+int check_idx_match(PGconn *conn, char *iname, char *new_iname);
+
 int rebuild_idx(PGconn *conn, char *iname);
 
+void init_rebuild(struct rebuild_t *rb, char *iname);
+
+void free_rebuild(struct rebuild_t *rb);
+
+int build_new_idx(PGconn *conn, struct rebuild_t *rb);
+
+int send_verify(PGconn *conn, struct rebuild_t *rb);
+
+int wait_verify(PGconn *conn, struct rebuild_t *rb);
+
+void finish_verified(PGconn *conn, PGconn *vconn, struct rebuild_t *rb,
+		     struct batch_stat_t *bs);
+
+void finish_rebuild(struct rebuild_t *rb, struct batch_stat_t *bs);
+
+int get_idx_io(PGconn *conn, char *iname, struct io_stat_t *io);
+
+void add_io_obs(struct io_obs_t **obs, int *n, struct rebuild_t *rb);
+
+void report_io_obs(PGconn *conn, struct io_obs_t *obs, int n);
+
+void print_io_per_scan(long scans, long blks, long reads);
+
+void log_batch_summary(struct batch_stat_t *bs);
+
+long get_wal_pos(PGconn *conn);
+
+int swap_new_idx(PGconn *conn, struct rebuild_t *rb);
+
+void phase_begin(PGconn *conn, struct rebuild_t *rb, int phase);
+
+void phase_end(PGconn *conn, struct rebuild_t *rb, int phase);
+
+void log_phase_timings(struct rebuild_t *rb);
+
+int start_probe(void);
+
+void stop_probe(void);
+
+void *probe_worker(void *arg);
+
+void set_probe_phase(int phase, int from);
+
 char *get_indexdef(PGconn *conn, char *iname);
 
-char *get_idx_comment(PGconn *conn, char *iname);
+int get_idx_comment(PGconn *conn, char *iname, char **icomm);
+
+int choose_fillfactor(PGconn *conn, struct rebuild_t *rb);
+
+char *set_tablespace(PGconn *conn, char *cmd, char *ts);
+
+int choose_tablespace(PGconn *conn, struct rebuild_t *rb);
+
+int is_local_conn(PGconn *conn);
+
+long get_ts_free(PGconn *conn, char *ts);
+
+int reconcile_idx(PGconn *conn, char *iname);
+
+int get_idx_contype(PGconn *conn, char *iname);
+
+int swap_constraint(PGconn *conn, struct rebuild_t *rb);
+
+int get_last_rebuild(char *db_name, char *iname, long *when, long *size);
+
+void save_rebuild(char *db_name, struct rebuild_t *rb, long size);
+
+void mark_build(char *db_name, char *new_iname, long state);
 
-char *make_new_iname(char *iname);
+int check_build_mark(char *db_name, char *new_iname);
 
-char *make_creat_cmd(char *new_iname, char *idef);
+int create_idx(PGconn *conn, char *cmd, double *wait_ms);
 
-int create_idx(PGconn *conn, char *cmd);
+int check_old_xacts(PGconn *conn, int terminate, int verbose);
+
+char *get_idx_table(PGconn *conn, char *iname);
+
+int wait_vacuum(PGconn *conn, char *tbl_name);
+
+void add_batch_table(struct batch_stat_t *bs, char *tbl_name);
+
+int post_vacuum(PGconn *conn, char *tbl_name);
+
+int terminate_backend(PGconn *conn, char *pid);
+
+int wait_old_xacts(PGconn *conn);
+
+void get_own_pids(PGconn *conn, char *buf, size_t len);
+
+void trace_wait_event(PGconn *mon, const char *pid, char *last,
+		      size_t len, double *last_ms);
 
 int add_comment(PGconn *conn, char *iname, char *comment);
 
@@ -70,13 +576,62 @@ int drop_idx(PGconn *conn, char *iname);
 
 int rename_idx(PGconn *conn, char *tmp_iname, char *iname);
 
+int exec_swap_cmd(PGconn *conn, char *cmd);
+
+int exec_watched(PGconn *conn, char *cmd);
+
+int check_lock_queue(PGconn *conn, int pid, int *blocked, int *block_ms,
+		     struct wd_pid_t *seen, int *n_seen);
+
+PGconn *get_mon_conn(PGconn *conn);
+
+PGconn *get_ver_conn(void);
+
+PGconn *get_extra_conn(PGconn **conn, char *conninfo);
+
+int prewarm_idx(PGconn *conn, char *iname, long budget);
+
+int check_extension(PGconn *conn, char *extname);
+
 int rebuild_from_file(PGconn *conn, char *filename);
 
 void set_statement_timeout(PGconn *conn, char *sec);
 
-unsigned get_rel_size(PGconn *conn, char *relname);
+long get_rel_size(PGconn *conn, char *relname);
+
+long estimate_gain(PGconn *conn, struct rebuild_t *rb);
+
+int run_daemon(PGconn *conn);
+
+void *dmn_worker(void *arg);
+
+void *dmn_client_worker(void *arg);
+
+void dmn_handle_client(int fd);
+
+int dmn_enqueue(int type, char *db_name, char *idx_name, char *reply);
+
+void dmn_status(int fd);
+
+int dmn_run_job(struct dmn_job_t *job);
+
+struct dmn_pool_t *dmn_get_pool(char *db_name);
+
+struct dmn_pool_t *dmn_conn_pool(PGconn *conn);
+
+void dmn_save_queue(void);
+
+void dmn_load_queue(void);
+
+int dmn_bloat_scan(PGconn *conn, char *db_name);
+
+int is_safe_name(char *name);
 
 void print_help(int rcode);
 
 void print_now_time(void);
+
+void sleep_ms(int ms);
+
+double now_ms(void);
 #endif
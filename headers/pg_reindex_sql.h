@@ -29,12 +29,9 @@
 
 #define GET_IDXDEF_SQL "SELECT indexdef FROM pg_indexes WHERE indexname = $1::text"
 
-#define IDX_BLOAT_STAT_SQL "SELECT\
- row_number() over(ORDER by bs*(relpages-est_pages_ff) DESC) AS n,\
- tblname, idxname, pg_size_pretty(bs*(relpages)::bigint) AS size,\
- pg_size_pretty(bs*(relpages-est_pages_ff)::bigint) AS bloat_size,\
- (100 * (relpages-est_pages_ff)::float / relpages)::numeric(5,2) AS bloat_ratio\
- FROM (SELECT coalesce(1 + ceil(reltuples/floor((bs-pageopqdata-pagehdr)/(4+nulldatahdrwidth)::float)), 0) AS est_pages,\
+// Statistical estimate of the btree leaf pages (est_pages_ff)
+// from pg_stats, one row per valid btree index:
+#define IDX_BLOAT_EST_HEAD "SELECT coalesce(1 + ceil(reltuples/floor((bs-pageopqdata-pagehdr)/(4+nulldatahdrwidth)::float)), 0) AS est_pages,\
  coalesce(1 + ceil(reltuples/floor((bs-pageopqdata-pagehdr)*fillfactor/(100*(4+nulldatahdrwidth)::float))), 0)\
  AS est_pages_ff, bs, nspname, table_oid, tblname, idxname, relpages, fillfactor, is_na\
  FROM (SELECT maxalign, bs, nspname, tblname, idxname, reltuples, relpages, relam, table_oid, fillfactor,\
@@ -58,15 +55,366 @@
  FROM pg_index JOIN pg_class idx ON idx.oid=pg_index.indexrelid\
  JOIN pg_class tbl ON tbl.oid=pg_index.indrelid\
  JOIN pg_namespace ON pg_namespace.oid = idx.relnamespace\
- WHERE pg_index.indisvalid AND pg_index.indisunique = 'f'\
- AND pg_index.indisprimary = 'f' AND tbl.relkind = 'r' AND idx.relpages > 0) AS i\
+ WHERE pg_index.indisvalid AND tbl.relkind = 'r' AND idx.relpages > 0"
+
+#define IDX_BLOAT_EST_TAIL ") AS i\
  ON a.attrelid = i.indexrelid JOIN pg_stats AS s ON s.schemaname = i.nspname\
  AND ((s.tablename = i.tblname AND s.attname = pg_catalog.pg_get_indexdef(a.attrelid, a.attnum, TRUE))\
  OR (s.tablename = i.idxname AND s.attname = a.attname))\
  JOIN pg_type AS t ON a.atttypid = t.oid WHERE a.attnum > 0\
  GROUP BY 1, 2, 3, 4, 5, 6, 7, 8, 9) AS s1) AS s2\
- JOIN pg_am am ON s2.relam = am.oid WHERE am.amname = 'btree') AS sub\
- WHERE nspname = 'public' AND bs*(relpages-est_pages_ff) > 1048576 LIMIT 50"
+ JOIN pg_am am ON s2.relam = am.oid WHERE am.amname = 'btree'"
+
+// Schemas of the reports: matching --schema ($1) and not
+// --exclude-schema ($2), never the system ones:
+#define SCHEMA_FILTER " AND nspname ~ $1 AND ($2::text IS NULL OR nspname !~ $2)\
+ AND nspname NOT IN ('pg_catalog', 'information_schema') AND nspname !~ '^pg_toast'"
+
+// Only indexes with more than 1 MB of estimated bloat are reported:
+#define BLOAT_MIN_FILTER "bs*(relpages-est_pages_ff) > 1048576"
+
+// One shard of the -s estimate: indexes of the tables with
+// oid % $3 = $4 in schemas matching $1 and not $2, top $5 of them
+#define IDX_BLOAT_SHARD_SQL "SELECT nspname, tblname, idxname,\
+ (bs*relpages)::bigint, (bs*(relpages-est_pages_ff))::bigint,\
+ (100 * (relpages-est_pages_ff)::float / relpages)::numeric(5,2)\
+ FROM (" IDX_BLOAT_EST_HEAD SCHEMA_FILTER "\
+ AND tbl.oid::bigint % $3 = $4" IDX_BLOAT_EST_TAIL ") AS sub\
+ WHERE " BLOAT_MIN_FILTER " ORDER BY 5 DESC LIMIT $5"
+
+// Size and the estimated reclaimable bytes of the btree index
+// by its name or oid, only this index is estimated:
+#define IDX_GAIN_EST_SQL "SELECT (bs*relpages)::bigint,\
+ greatest(bs*(relpages-est_pages_ff), 0)::bigint\
+ FROM (" IDX_BLOAT_EST_HEAD "\
+ AND idx.oid = $1::regclass" IDX_BLOAT_EST_TAIL ") AS sub"
+
+#define GET_IDX_OID_SQL "SELECT $1::regclass::oid"
+
+// Unused index candidates for the report across servers, the
+// same filter as GET_UNUSED_IDX_SQL:
+#define GET_UNUSED_CAND_SQL "SELECT c.oid, c.relname, idx.indrelid::regclass,\
+ pg_relation_size(c.oid) FROM pg_index AS idx JOIN pg_class AS c ON c.oid = idx.indexrelid\
+ JOIN pg_namespace AS n ON n.oid = c.relnamespace\
+ WHERE pg_relation_size(c.oid) > $1 AND NOT idx.indisprimary AND NOT idx.indisunique\
+ AND n.nspname NOT IN ('pg_catalog', 'information_schema') AND n.nspname !~ '^pg_toast'\
+ ORDER BY pg_relation_size(c.oid) DESC"
+
+// Usage counters of a server by the index oid, also
+// for the --analyze-host snapshot:
+#define GET_IDX_USAGE_SQL "SELECT indexrelid, idx_scan FROM pg_stat_user_indexes ORDER BY 1"
+
+// Is the server a standby and its replay lag in seconds,
+// 0 if all received WAL is replayed:
+#define GET_REPLAY_LAG_SQL "SELECT pg_is_in_recovery(),\
+ CASE WHEN NOT pg_is_in_recovery()\
+ OR pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() THEN 0\
+ ELSE coalesce(extract(epoch FROM now() - pg_last_xact_replay_timestamp()), 0) END"
+
+// The same before PostgreSQL 10:
+#define GET_XLOG_REPLAY_LAG_SQL "SELECT pg_is_in_recovery(),\
+ CASE WHEN NOT pg_is_in_recovery()\
+ OR pg_last_xlog_receive_location() = pg_last_xlog_replay_location() THEN 0\
+ ELSE coalesce(extract(epoch FROM now() - pg_last_xact_replay_timestamp()), 0) END"
+
+// Oid, blocks, fillfactor and block size of the index to sample:
+#define GET_IDX_SAMPLE_SQL "SELECT c.oid,\
+ pg_relation_size(c.oid) / current_setting('block_size')::int,\
+ coalesce(substring(array_to_string(c.reloptions, ' ')\
+ FROM 'fillfactor=([0-9]+)')::smallint,\
+ CASE am.amname WHEN 'hash' THEN 75 ELSE 90 END),\
+ current_setting('block_size')::int\
+ FROM pg_class AS c JOIN pg_am AS am ON am.oid = c.relam\
+ WHERE c.oid = $1::regclass"
+
+// One row per user index for all reports of --health:
+// schema, table, index, size, valid, unique, idx_scan, am,
+// the estimated bloat of btree indexes and oid. The bloat is
+// only set for the indexes -s would show, schemas $1 and not $2
+#define HEALTH_SNAPSHOT_SQL "SELECT n.nspname, t.relname, c.relname,\
+ pg_relation_size(c.oid), i.indisvalid, i.indisunique OR i.indisprimary,\
+ s.idx_scan, am.amname,\
+ CASE WHEN e.relpages > 0 THEN greatest(e.bs*(e.relpages-e.est_pages_ff), 0)::bigint END,\
+ c.oid FROM pg_index AS i JOIN pg_class AS c ON c.oid = i.indexrelid\
+ JOIN pg_class AS t ON t.oid = i.indrelid\
+ JOIN pg_namespace AS n ON n.oid = c.relnamespace\
+ JOIN pg_am AS am ON am.oid = c.relam\
+ LEFT JOIN pg_stat_user_indexes AS s ON s.indexrelid = c.oid\
+ LEFT JOIN (SELECT * FROM (" IDX_BLOAT_EST_HEAD SCHEMA_FILTER IDX_BLOAT_EST_TAIL ") AS est\
+ WHERE " BLOAT_MIN_FILTER ") AS e ON e.nspname = n.nspname AND e.idxname = c.relname\
+ WHERE n.nspname NOT IN ('pg_catalog', 'information_schema')\
+ AND n.nspname !~ '^pg_toast' ORDER BY 1, 3"
+
+// Sessions queued behind the backend and the longest time
+// one of them waits for a lock (pg_locks.waitstart, PG 14+):
+#define LOCK_QUEUE_SQL "SELECT count(DISTINCT a.pid),\
+ coalesce(max(extract(epoch FROM clock_timestamp() - l.waitstart) * 1000), 0)::int\
+ FROM pg_stat_activity a LEFT JOIN pg_locks l ON l.pid = a.pid AND NOT l.granted\
+ WHERE $1::int = ANY(pg_blocking_pids(a.pid))"
+
+// The same before PG 14, wait times are tracked by the client:
+#define LOCK_QUEUE_PIDS_SQL "SELECT pid FROM pg_stat_activity\
+ WHERE $1::int = ANY(pg_blocking_pids(pid))"
+
+#define CHECK_EXTENSION_SQL "SELECT extname FROM pg_extension WHERE extname = $1::text"
+
+#define GET_IDX_BLOCKS_SQL "SELECT pg_relation_size(c.oid) / current_setting('block_size')::int,\
+ current_setting('block_size')::int, am.amname\
+ FROM pg_class AS c JOIN pg_am AS am ON am.oid = c.relam\
+ WHERE c.oid = $1::regclass"
+
+#define PREWARM_IDX_SQL "SELECT pg_prewarm($1::regclass)"
+
+#define PREWARM_RANGE_SQL "SELECT pg_prewarm($1::regclass, 'buffer', 'main', $2::int8, $3::int8)"
+
+// Walk the btree from the root down to level 1 with pageinspect
+// and load the inner pages, level by level, up to $3 of them.
+// $2 is the number of blocks. The recursive query is run only
+// as far as LIMIT pulls it, so the walk stops with the budget:
+#define PREWARM_BT_UPPER_SQL "WITH RECURSIVE up(blk, lvl) AS (\
+ SELECT root::int8, level FROM bt_metap($1::text) WHERE level > 0\
+ UNION SELECT (i.ctid::text::point)[0]::int8, up.lvl - 1\
+ FROM up, bt_page_items($1::text, up.blk::int) AS i WHERE up.lvl > 1)\
+ SELECT coalesce(sum(pg_prewarm($1::regclass, 'buffer', 'main', blk, blk)), 0)\
+ FROM (SELECT blk FROM up WHERE blk > 0 AND blk < $2::int8 LIMIT $3::int8) AS b"
+
+// Top $4 largest indexes of the access methods in the $3 array
+// in schemas matching $1 and not $2:
+#define GET_SAMPLE_IDX_SQL "SELECT c.oid, n.nspname || '.' || c.relname,\
+ pg_relation_size(c.oid) / current_setting('block_size')::int AS nblocks,\
+ current_setting('block_size')::int AS bs,\
+ coalesce(substring(array_to_string(c.reloptions, ' ')\
+ FROM 'fillfactor=([0-9]+)')::smallint,\
+ CASE am.amname WHEN 'hash' THEN 75 ELSE 90 END) AS fillfactor,\
+ am.amname,\
+ pg_relation_size(i.indrelid) / current_setting('block_size')::int AS tbl_nblocks\
+ FROM pg_index AS i JOIN pg_class AS c ON c.oid = i.indexrelid\
+ JOIN pg_namespace AS n ON n.oid = c.relnamespace\
+ JOIN pg_am AS am ON am.oid = c.relam\
+ WHERE am.amname = ANY($3::text[]) AND i.indisvalid" SCHEMA_FILTER "\
+ AND (pg_relation_size(c.oid) > 1048576 OR am.amname = 'brin')\
+ ORDER BY pg_relation_size(c.oid) DESC LIMIT $4"
+
+// Stats of the sampled pages; $2 is an array of block numbers.
+// The type is 'l' for pages with data, 'd' for deleted or unused
+// pages and anything else for service pages:
+#define SAMPLE_BT_PAGES_SQL "SELECT s.type, s.free_size, s.page_size\
+ FROM unnest($2::int8[]) AS b, bt_page_stats($1::regclass::text, b::int) AS s"
+
+#define SAMPLE_GIN_PAGES_SQL "SELECT CASE\
+ WHEN 'deleted' = ANY(o.flags) THEN 'd'\
+ WHEN 'leaf' = ANY(o.flags) AND NOT 'list' = ANY(o.flags) THEN 'l'\
+ ELSE 'i' END, h.upper - h.lower, h.pagesize\
+ FROM unnest($2::int8[]) AS b,\
+ LATERAL get_raw_page($1::regclass::text, b::int) AS r,\
+ LATERAL page_header(r) AS h, LATERAL gin_page_opaque_info(r) AS o"
+
+#define SAMPLE_GIST_PAGES_SQL "SELECT CASE\
+ WHEN h.lower <= 24 THEN 'd' ELSE 'l' END, h.upper - h.lower, h.pagesize\
+ FROM unnest($2::int8[]) AS b,\
+ LATERAL page_header(get_raw_page($1::regclass::text, b::int)) AS h"
+
+#define SAMPLE_HASH_PAGES_SQL "SELECT CASE hash_page_type(r)\
+ WHEN 'bucket' THEN 'l' WHEN 'overflow' THEN 'l'\
+ WHEN 'unused' THEN 'd' ELSE 'i' END, h.upper - h.lower, h.pagesize\
+ FROM unnest($2::int8[]) AS b,\
+ LATERAL get_raw_page($1::regclass::text, b::int) AS r,\
+ LATERAL page_header(r) AS h"
+
+// Pending list of the GIN index in pages (pgstattuple):
+#define GIN_PENDING_SQL "SELECT pending_pages FROM pgstatginindex($1::regclass)"
+
+// Summarized and all page ranges of the table with the BRIN index:
+#define BRIN_COVERAGE_SQL "SELECT count(*) FILTER (WHERE d.pages <> '(0,0)'),\
+ ceil($2::int8 / m.pagesperrange::float)::int8\
+ FROM brin_metapage_info(get_raw_page($1::regclass::text, 0)) AS m,\
+ generate_series(1, m.lastrevmappage) AS b,\
+ brin_revmap_data(get_raw_page($1::regclass::text, b::int)) AS d\
+ GROUP BY m.pagesperrange"
+
+// WAL insert position in bytes since 0/0:
+#define GET_WAL_POS_SQL "SELECT pg_wal_lsn_diff(pg_current_wal_lsn(), '0/0')::int8"
+
+#define GET_XLOG_POS_SQL "SELECT pg_xlog_location_diff(pg_current_xlog_location(), '0/0')::int8"
+
+#define VERIFY_IDX_SQL "SELECT bt_index_check($1::regclass)"
+
+// Write activity of the table of the index since
+// the statistic reset, the last column is seconds:
+#define GET_TBL_CHURN_SQL "SELECT t.n_tup_ins, t.n_tup_upd, t.n_tup_hot_upd,\
+ t.n_live_tup, extract(epoch FROM now() -\
+ coalesce(d.stats_reset, pg_postmaster_start_time()))::int8\
+ FROM pg_stat_user_tables AS t, pg_stat_database AS d\
+ WHERE t.relid = (SELECT indrelid FROM pg_index WHERE indexrelid = $1::regclass)\
+ AND d.datname = current_database()"
+
+// Correlation of the leading index column with the table
+// order, no rows for an expression or without statistics:
+#define GET_LEAD_CORR_SQL "SELECT s.correlation FROM pg_index i\
+ JOIN pg_class c ON c.oid = i.indrelid JOIN pg_namespace n ON n.oid = c.relnamespace\
+ JOIN pg_attribute a ON a.attrelid = i.indrelid AND a.attnum = i.indkey[0]\
+ JOIN pg_stats s ON s.schemaname = n.nspname AND s.tablename = c.relname\
+ AND s.attname = a.attname WHERE i.indexrelid = $1::regclass\
+ AND s.correlation IS NOT NULL"
+
+// Scans and blocks read per second since the statistic
+// reset and the current tablespace of the index:
+#define GET_IDX_HEAT_SQL "SELECT coalesce(s.idx_scan, 0) / greatest(extract(epoch FROM now() -\
+ coalesce(d.stats_reset, pg_postmaster_start_time())), 1),\
+ coalesce(io.idx_blks_read, 0) / greatest(extract(epoch FROM now() -\
+ coalesce(d.stats_reset, pg_postmaster_start_time())), 1),\
+ coalesce(t.spcname, '')\
+ FROM pg_class AS c LEFT JOIN pg_tablespace AS t ON t.oid = c.reltablespace\
+ LEFT JOIN pg_stat_user_indexes AS s ON s.indexrelid = c.oid\
+ LEFT JOIN pg_statio_user_indexes AS io ON io.indexrelid = c.oid\
+ JOIN pg_stat_database AS d ON d.datname = current_database()\
+ WHERE c.oid = $1::regclass"
+
+// Directory of the tablespace, of the data directory for the default:
+#define GET_TS_PATH_SQL "SELECT CASE WHEN spcname IN ('pg_default', 'pg_global')\
+ THEN current_setting('data_directory') ELSE pg_tablespace_location(oid) END\
+ FROM pg_tablespace WHERE spcname = $1::text"
+
+#define GET_IDX_AM_SQL "SELECT am.amname FROM pg_class AS c\
+ JOIN pg_am AS am ON am.oid = c.relam WHERE c.oid = $1::regclass"
+
+// Compare the new index with the old one: table, access method,
+// keys, operator classes, expressions, predicate and storage
+// parameters except fillfactor must be the same:
+#define CHECK_IDX_MATCH_SQL "SELECT o.relam = n.relam\
+ AND oi.indrelid = ni.indrelid\
+ AND oi.indisunique = ni.indisunique\
+ AND oi.indkey::text = ni.indkey::text\
+ AND oi.indclass::text = ni.indclass::text\
+ AND oi.indcollation::text = ni.indcollation::text\
+ AND oi.indoption::text = ni.indoption::text\
+ AND coalesce(pg_get_expr(oi.indexprs, oi.indrelid), '')\
+ = coalesce(pg_get_expr(ni.indexprs, ni.indrelid), '')\
+ AND coalesce(pg_get_expr(oi.indpred, oi.indrelid), '')\
+ = coalesce(pg_get_expr(ni.indpred, ni.indrelid), '')\
+ AND array(SELECT x FROM unnest(o.reloptions) AS x\
+ WHERE x NOT LIKE 'fillfactor=%' ORDER BY 1)\
+ = array(SELECT x FROM unnest(n.reloptions) AS x\
+ WHERE x NOT LIKE 'fillfactor=%' ORDER BY 1)\
+ FROM pg_index AS oi JOIN pg_class AS o ON o.oid = oi.indexrelid,\
+ pg_index AS ni JOIN pg_class AS n ON n.oid = ni.indexrelid\
+ WHERE o.oid = $1::regclass AND n.oid = $2::regclass"
+
+// Leftovers of failed rebuilds: "new_" indexes, all the ones
+// on the search_path or $1 in the schema of the index it was
+// built for (found like other names, by the search_path).
+// writes is
+// index entries added per second by inserts and non-HOT updates
+// of the table, building is true when another session locks the
+// index or holds the ShareUpdateExclusiveLock of the table, which
+// CREATE INDEX and REINDEX CONCURRENTLY keep until they finish:
+#define GET_LEFTOVER_IDX_SQL "SELECT c.relname, i.indisvalid, i.indisready,\
+ pg_relation_size(c.oid), substr(c.relname, 5),\
+ EXISTS (SELECT 1 FROM pg_class AS b WHERE b.relkind = 'i'\
+ AND b.relnamespace = c.relnamespace AND b.relname = substr(c.relname, 5)),\
+ coalesce((st.n_tup_ins + st.n_tup_upd - st.n_tup_hot_upd) /\
+ greatest(extract(epoch FROM now() - coalesce(d.stats_reset, pg_postmaster_start_time())), 1), 0),\
+ EXISTS (SELECT 1 FROM pg_locks AS l WHERE l.pid <> pg_backend_pid()\
+ AND l.database = d.datid AND (l.relation = c.oid OR (l.relation = i.indrelid AND l.mode = 'ShareUpdateExclusiveLock')))\
+ FROM pg_class AS c JOIN pg_index AS i ON i.indexrelid = c.oid\
+ JOIN pg_namespace AS n ON n.oid = c.relnamespace\
+ LEFT JOIN pg_stat_user_tables AS st ON st.relid = i.indrelid\
+ JOIN pg_stat_database AS d ON d.datname = current_database()\
+ WHERE c.relname LIKE 'new\\_%' AND CASE WHEN $1::text IS NULL THEN pg_table_is_visible(c.oid)\
+ ELSE c.relname = $1::text AND c.relnamespace = coalesce(\
+ (SELECT relnamespace FROM pg_class WHERE oid = to_regclass(substr($1::text, 5))),\
+ (SELECT relnamespace FROM pg_class WHERE oid = to_regclass($1::text))) END\
+ AND n.nspname NOT IN ('pg_catalog', 'information_schema') AND n.nspname !~ '^pg_toast'\
+ ORDER BY 1"
+
+// Type of the constraint of the table backed by the index:
+#define GET_IDX_CONTYPE_SQL "SELECT con.contype FROM pg_constraint AS con\
+ JOIN pg_index AS i ON i.indexrelid = con.conindid AND i.indrelid = con.conrelid\
+ WHERE con.conindid = $1::regclass AND con.contype IN ('p', 'u', 'x')"
+
+// Moves the constraint of the index $1 to the index $2,
+// the new index takes the constraint name. The second
+// column restores the comment of the constraint:
+#define GET_CONSTR_SWAP_SQL "SELECT format('ALTER TABLE %s DROP CONSTRAINT %I,\
+ ADD CONSTRAINT %I %s USING INDEX %I%s%s', con.conrelid::regclass, con.conname, con.conname,\
+ CASE con.contype WHEN 'p' THEN 'PRIMARY KEY' ELSE 'UNIQUE' END, $2::text,\
+ CASE WHEN con.condeferrable THEN ' DEFERRABLE' ELSE '' END,\
+ CASE WHEN con.condeferred THEN ' INITIALLY DEFERRED' ELSE '' END),\
+ format('COMMENT ON CONSTRAINT %I ON %s IS %L', con.conname, con.conrelid::regclass,\
+ obj_description(con.oid, 'pg_constraint'))\
+ FROM pg_constraint AS con JOIN pg_index AS i\
+ ON i.indexrelid = con.conindid AND i.indrelid = con.conrelid\
+ WHERE con.conindid = $1::regclass AND con.contype IN ('p', 'u')"
+
+// Foreign keys referencing the index: drop, re-add as NOT VALID,
+// validate (if it was validated) and comment commands. Before
+// PostgreSQL 18 a partitioned table can not add a NOT VALID
+// foreign key, it is added validated:
+#define GET_FK_CMDS_HEAD "SELECT\
+ format('ALTER TABLE %s DROP CONSTRAINT %I', conrelid::regclass, conname),\
+ format('ALTER TABLE %s ADD CONSTRAINT %I %s%s', conrelid::regclass, conname,\
+ pg_get_constraintdef(oid), CASE WHEN NOT (convalidated AND part) THEN ' NOT VALID' ELSE '' END),\
+ CASE WHEN convalidated AND NOT part THEN format('ALTER TABLE %s VALIDATE CONSTRAINT %I',\
+ conrelid::regclass, conname) END,\
+ format('COMMENT ON CONSTRAINT %I ON %s IS %L', conname, conrelid::regclass,\
+ obj_description(oid, 'pg_constraint'))\
+ FROM (SELECT con.oid, con.conrelid, con.conname, con.convalidated,\
+ current_setting('server_version_num')::int < 180000\
+ AND (SELECT relkind FROM pg_class WHERE oid = con.conrelid) = 'p' AS part\
+ FROM pg_constraint AS con WHERE contype = 'f' AND conindid = $1::regclass"
+
+// Only the parent constraint of a partitioned table, the ones
+// of its partitions go with it (conparentid is PostgreSQL 11+):
+#define GET_FK_CMDS_SQL GET_FK_CMDS_HEAD " AND conparentid = 0) AS fk"
+
+#define GET_FK_CMDS_10_SQL GET_FK_CMDS_HEAD ") AS fk"
+
+// Transactions of the database holding a snapshot or an xid
+// for more than $1 seconds, except the sessions in $2:
+#define GET_OLD_XACTS_HEAD "SELECT pid, coalesce(usename, ''), coalesce(state, ''),\
+ extract(epoch FROM now() - xact_start)::int, left(coalesce(query, ''), 60)\
+ FROM pg_stat_activity WHERE datname = current_database()\
+ AND pid <> ALL($2::int[]) AND (backend_xmin IS NOT NULL OR backend_xid IS NOT NULL)\
+ AND xact_start < now() - $1::int * interval '1 second'"
+
+// Only client backends, CREATE INDEX CONCURRENTLY does not
+// wait for vacuum (backend_type is PostgreSQL 10+, before it
+// pg_stat_activity shows client backends only):
+#define GET_OLD_XACTS_SQL GET_OLD_XACTS_HEAD\
+ " AND backend_type = 'client backend' ORDER BY xact_start"
+
+#define GET_OLD_XACTS_96_SQL GET_OLD_XACTS_HEAD " ORDER BY xact_start"
+
+// Sessions the backend $1 waits for on their virtual xid,
+// except the sessions in $2 (pg_reindex's own connections:
+// the pipelined verification holds a snapshot too):
+#define GET_SNAP_WAIT_SQL "SELECT a.pid, coalesce(a.state, ''),\
+ extract(epoch FROM now() - a.xact_start)::int FROM pg_stat_activity AS a\
+ WHERE a.pid = ANY(pg_blocking_pids($1::int)) AND a.pid <> ALL($2::int[]) AND EXISTS (SELECT 1 FROM pg_locks AS l\
+ WHERE l.pid = $1::int AND l.locktype = 'virtualxid' AND NOT l.granted)"
+
+#define GET_IDX_TBL_SQL "SELECT indrelid::regclass FROM pg_index WHERE indexrelid = $1::regclass"
+
+// Vacuums running on the table, the last column
+// is true for autovacuum workers:
+#define GET_TBL_VACUUM_SQL "SELECT p.pid, p.phase, coalesce(a.query LIKE 'autovacuum:%', false)\
+ FROM pg_stat_progress_vacuum AS p LEFT JOIN pg_stat_activity AS a ON a.pid = p.pid\
+ WHERE p.relid = $1::regclass"
+
+// Dead tuples in % of all tuples of the table:
+#define GET_DEAD_RATIO_SQL "SELECT coalesce(100.0 * n_dead_tup /\
+ nullif(n_live_tup + n_dead_tup, 0), 0) FROM pg_stat_user_tables WHERE relid = $1::regclass"
+
+// Scans and block reads of the index for --observe:
+#define GET_IDX_IO_SQL "SELECT s.idx_scan, io.idx_blks_read, io.idx_blks_hit\
+ FROM pg_stat_user_indexes s JOIN pg_statio_user_indexes io USING (indexrelid)\
+ WHERE s.indexrelid = $1::regclass"
+
+// Wait event of the backend, CPU if it does not wait:
+#define GET_WAIT_EVENT_SQL "SELECT coalesce(wait_event_type || ':' || wait_event, 'CPU')\
+ FROM pg_stat_activity WHERE pid = $1::int"
+
+#define TERMINATE_SQL "SELECT pg_terminate_backend($1::int)"
 
 #define GET_INV_IDX_SQL "SELECT c.relname AS index_name FROM pg_catalog.pg_class AS c\
  JOIN pg_catalog.pg_index AS i ON c.oid = i.indexrelid AND indisvalid = 'f'"
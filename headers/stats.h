@@ -0,0 +1,34 @@
+#ifndef STATS_H
+#define STATS_H
+
+// z-value of the two-sided 95% confidence interval:
+#define Z_95 1.96
+
+// Running mean and variance (Welford's method):
+struct run_stat_t {
+	long n;
+	double mean;
+	double m2;
+};
+
+// Log-linear histogram: every power of two of the value
+// is split into HIST_SUB buckets (~6% precision):
+#define HIST_SUB 16
+#define HIST_POW 40
+
+struct hist_t {
+	long count;
+	double max;
+	long buckets[HIST_POW * HIST_SUB];
+};
+
+void run_stat_init(struct run_stat_t *st);
+void run_stat_add(struct run_stat_t *st, double x);
+double run_stat_var(struct run_stat_t *st);
+double run_stat_ci(struct run_stat_t *st);
+
+void hist_init(struct hist_t *h);
+void hist_add(struct hist_t *h, double x);
+double hist_quantile(struct hist_t *h, double q);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef TEXTUTIL_H
+#define TEXTUTIL_H
+
+#include <stddef.h>
+
+// Text helpers that need no connection, they are shared
+// with the microbenchmarks in bench/:
+char *make_new_iname(char *iname);
+char *make_creat_cmd(char *new_iname, char *idef);
+char *set_fillfactor(char *cmd, int ff);
+char *find_top_where(char *def);
+int parse_idx_line(char *str);
+void format_size(long bytes, char *buf, size_t len);
+int parse_size(const char *str, long *bytes);
+
+#endif
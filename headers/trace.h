@@ -0,0 +1,23 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+// Chrome/Perfetto trace-event JSON, timestamps are in ms of
+// CLOCK_MONOTONIC and tracks are threads (tid) of one process:
+#define TRACE_PID 1
+
+int trace_open(const char *path);
+void trace_close(void);
+int trace_enabled(void);
+
+void trace_track_name(int tid, const char *name);
+void trace_complete(int tid, const char *name, const char *cat,
+		    double start_ms, double dur_ms,
+		    const char *arg_name, const char *arg_val);
+void trace_instant(int tid, const char *name, const char *cat,
+		   double ts_ms, const char *arg_name, const char *arg_val);
+
+void print_json_str(FILE *fp, const char *str);
+
+#endif
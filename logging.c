@@ -25,6 +25,8 @@ void log_write(FILE* fp, int lvl_code, char *fmt,...)
 	va_list list;
 	char *p, *r, *t_stamp, *lvl;
 	int e;
+	long l;
+	double d;
 
 	if (!fp) {
 		printf("The passed file pointer to log_write() is NULL\n");
@@ -66,6 +68,20 @@ void log_write(FILE* fp, int lvl_code, char *fmt,...)
  
 					fprintf(fp, "%d", e);
 					continue;
+
+				case 'l' :
+					if (*(p + 1) == 'd')
+						++p;
+					l = va_arg(list, long);
+
+					fprintf(fp, "%ld", l);
+					continue;
+
+				case 'f' :
+					d = va_arg(list, double);
+
+					fprintf(fp, "%.2f", d);
+					continue;
                 
 				default:
 					fputc(*p, fp);
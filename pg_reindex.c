@@ -6,30 +6,46 @@
  * Author: Andrey Klychkov <aaklychkov@mail.ru>
  * See README.md on https://github.com/Andersson007
  */ 
+#define _POSIX_C_SOURCE 200809L
+
 #include <ctype.h>
 #include <getopt.h>
 #include <libpq-fe.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/un.h>
 #include <time.h>
+#include <unistd.h>
 #include "headers/pg_reindex_sql.h"
 #include "headers/pg_reindex.h"
 #include "headers/logging.h"
+#include "headers/stats.h"
+#include "headers/textutil.h"
+#include "headers/trace.h"
 
 
 int main(int argc, char **argv)
 {
 	log_fp = NULL;
+	mon_conn = NULL;
+	ver_conn = NULL;
+	ana_conn = NULL;
 	int ret = 0;
+	int rep_ret = SUCCESS;
 	char *conn_pref = NULL;
 	char *conninfo = NULL;
 	PGconn *conn = NULL;
-	FILE *file = NULL;
+	PGconn *aconn = NULL;
 	char *fname = NULL;
-	char *str = NULL;
-	char *ptr = NULL;
-	char buf[68];
 
 	// Default values of command-line arguments:
 	glob_args.db_name = NULL;
@@ -41,6 +57,48 @@ int main(int argc, char **argv)
 	glob_args.stat = 0;
 	glob_args.inval = 0;
 	glob_args.new_pref = 0;
+	glob_args.watchdog = 0;
+	glob_args.max_blocked = WD_MAX_BLOCKED;
+	glob_args.max_block_ms = WD_MAX_BLOCK_MS;
+	glob_args.swap_retries = WD_RETRIES;
+	glob_args.prewarm = 0;
+	glob_args.prewarm_budget = 0;
+	glob_args.sock_path = NULL;
+	glob_args.scan_interval = 0;
+	glob_args.sample = 0;
+	glob_args.sample_ci = SMP_CI;
+	glob_args.sample_max = SMP_MAX_PCT;
+	glob_args.verify = 0;
+	glob_args.probe_sql = NULL;
+	glob_args.probe_rate = PRB_RATE;
+	glob_args.probe_baseline = PRB_BASELINE_SEC;
+	glob_args.auto_ff = 0;
+	glob_args.history = HISTORY_FILE;
+	glob_args.ts_hot = NULL;
+	glob_args.ts_cold = NULL;
+	glob_args.hot_scans = TS_HOT_SCANS;
+	glob_args.hot_reads = TS_HOT_READS;
+	glob_args.cold_scans = TS_COLD_SCANS;
+	glob_args.reconcile = 0;
+	glob_args.xact_policy = XACT_WARN;
+	glob_args.xact_max_age = XACT_MAX_AGE;
+	glob_args.defer_max = XACT_DEFER_MAX;
+	glob_args.min_gain = 0;
+	glob_args.min_gain_pct = 0;
+	glob_args.health = 0;
+	glob_args.ana_host = NULL;
+	glob_args.max_lag = ANA_MAX_LAG;
+	glob_args.post_analyze = 0;
+	glob_args.vacuum_dead = VAC_DEAD_PCT;
+	glob_args.n_standbys = 0;
+	glob_args.usage_file = USAGE_FILE;
+	glob_args.unused_days = 0;
+	glob_args.trace_file = NULL;
+	glob_args.observe = 0;
+	glob_args.jobs = 1;
+	glob_args.top = BLOAT_TOP;
+	glob_args.schema = BLOAT_SCHEMA;
+	glob_args.excl_schema = NULL;
 
 	// Get command-line arguments:
 	get_opts(argc, argv);
@@ -54,6 +112,17 @@ int main(int argc, char **argv)
 
 	printf("log is collecting to %s\n", glob_args.log_filename);
 
+	// Write the timeline of the run:
+	if (glob_args.trace_file) {
+		if (trace_open(glob_args.trace_file)) {
+			trace_track_name(TRK_MAIN, "main connection");
+			trace_track_name(TRK_MON, "monitoring connection");
+			trace_track_name(TRK_VER, "verify connection");
+		} else
+			fprintf(stderr, "Could not open the trace file %s\n",
+				glob_args.trace_file);
+	}
+
 	conn_pref = "dbname=";
 	conninfo = (char*)malloc((strlen(conn_pref) +
 		strlen(glob_args.db_name) + 1) * sizeof(char));
@@ -74,32 +143,115 @@ int main(int argc, char **argv)
 		exit_nicely(conn);
 	}
 
-	free(conninfo);
+	// Keep the connection string for additional connections:
+	db_conninfo = conninfo;
+
+	// Serve jobs from the control socket until shutdown:
+	if (glob_args.sock_path) {
+		// Waiting for the window would stall the job queue:
+		if (glob_args.observe > 0) {
+			log_write(log_fp, WRN, "--observe is ignored "
+				  "in the daemon mode\n");
+			glob_args.observe = 0;
+		}
+
+		ret = run_daemon(conn);
+		free(conninfo);
+		return ret;
+	}
+
+	// Catalog reports run on the standby with --analyze-host:
+	if ((glob_args.health || glob_args.new_pref || glob_args.stat ||
+	     glob_args.sample || glob_args.inval) &&
+	    (aconn = get_ana_conn(conn)) == NULL) {
+		fprintf(stderr, "Standby for analysis is not usable, "
+			"see the log for more info\n");
+		exit_nicely(conn);
+	}
+
+	// Print all reports from one catalog snapshot:
+	if (glob_args.health) {
+		log_write(log_fp, INF, "Show health snapshot\n");
+		if (print_health(aconn, conn) != SUCCESS)
+			rep_ret = FAIL;
+	}
 
 	// Print indexes with the "new_" prefix:
 	if (glob_args.new_pref) {
 		log_write(log_fp, INF, "Show new_ indexes\n");
-		show_new_pref_idx(conn);
+		if (show_new_pref_idx(aconn) != SUCCESS)
+			rep_ret = FAIL;
 	}
 
 	// Print top of bloated indexes:
 	if (glob_args.stat) {
 		log_write(log_fp, INF, "Show bloat stat\n");
-		print_bloat_stat(conn);
+		if (print_bloat_stat(aconn) != SUCCESS)
+			rep_ret = FAIL;
+	}
+
+	// Print bloat estimated from sampled pages:
+	if (glob_args.sample) {
+		log_write(log_fp, INF, "Show sampled bloat stat\n");
+		if (print_sampled_bloat(aconn) != SUCCESS)
+			rep_ret = FAIL;
 	}
 
 	// Print invalid indexes:
 	if (glob_args.inval) {
 		log_write(log_fp, INF, "Show invalid indexes\n");
-		print_invalid_idx(conn);
+		if (print_invalid_idx(aconn) != SUCCESS)
+			rep_ret = FAIL;
+	}
+
+	// Clean up leftovers of failed rebuilds:
+	if (glob_args.reconcile && !glob_args.idx_name &&
+	    !glob_args.idx_filename) {
+		log_write(log_fp, INF, "Reconcile leftover indexes\n");
+		reconcile_idx(conn, NULL);
 	}
 
-	// Print unused indexes with size more than passed "size_thresh":
-	if (glob_args.size_thresh) {
+	// Print unused indexes with size more than passed "size_thresh",
+	// scan counters are kept by each server, so on the primary;
+	// with --health it is only the threshold of its report:
+	if (glob_args.size_thresh && !glob_args.health) {
 		log_write(log_fp, INF, "Show unused indexes\n");
-		print_not_used_idx(conn, "0", glob_args.size_thresh);
+
+		if (glob_args.n_standbys || glob_args.unused_days)
+			ret = print_unused_agg(conn, glob_args.size_thresh);
+		else
+			ret = print_not_used_idx(conn, "0",
+			                         glob_args.size_thresh);
+
+		if (ret != SUCCESS)
+			rep_ret = FAIL;
+	}
+
+	// Reports do not rebuild anything:
+	if (glob_args.new_pref || glob_args.stat || glob_args.sample ||
+	    glob_args.inval || glob_args.size_thresh || glob_args.health ||
+	    (glob_args.reconcile && !glob_args.idx_name &&
+	     !glob_args.idx_filename)) {
+		PQfinish(conn);
+		if (ana_conn)
+			PQfinish(ana_conn);
+		free(conninfo);
+		trace_close();
+		return rep_ret == SUCCESS ? 0 : 1;
+	}
+
+	// Verification of new indexes needs amcheck:
+	if (glob_args.verify && (glob_args.idx_name || glob_args.idx_filename) &&
+	    !check_extension(conn, "amcheck")) {
+		fprintf(stderr, "Extension amcheck not found\n");
+		log_write(log_fp, ERR, "Extension amcheck not found\n");
+		exit_nicely(conn);
 	}
 
+	// Measure the application latency during rebuilding:
+	if (glob_args.probe_sql && (glob_args.idx_name || glob_args.idx_filename))
+		start_probe();
+
 	// Rebuild an index with a passed name:
 	if (glob_args.idx_name) {
 		print_now_time();
@@ -122,43 +274,22 @@ int main(int argc, char **argv)
 		log_write(log_fp, INF,
 			  "Rebuild indexes from the file %s\n", fname);
 
-		file = fopen(fname, "r");
-
-		if (!file) {
-			fprintf(stderr,
-				"Could not open the file %s\n", fname);
-			log_write(log_fp, ERR,
-			          "Could not open the file %s\n", fname);
-			exit_nicely(conn);
-		}
-
-		while (1) {
-			str = fgets(buf, sizeof(buf), file);
-
-			if (str == NULL) {
-				if (feof(file) != 0) {
-					break;
-				} else {
-					fprintf(stderr,
-                                                "Error of reading file, exit\n");
-					log_write(log_fp, ERR,
-                                                  "Error of reading file\n");
-					exit_nicely(conn);
-				}
-			}
-
-			if (isalpha(str[0])) {
-				ptr = strchr(str, '\n');
-				if (ptr != NULL) *ptr = '\0';
-
-				// For each indexname in the file, do:
-				rebuild_idx(conn, str);
-			}
-		}
+		rebuild_from_file(conn, fname);
 	}
 
+	if (glob_args.probe_sql && (glob_args.idx_name || glob_args.idx_filename))
+		stop_probe();
+
 	// Close a connection to the database and cleanup:
+	if (mon_conn)
+		PQfinish(mon_conn);
+	if (ver_conn)
+		PQfinish(ver_conn);
+	if (ana_conn)
+		PQfinish(ana_conn);
 	PQfinish(conn);
+	free(conninfo);
+	trace_close();
 	return 0;
 }
 
@@ -168,8 +299,9 @@ int main(int argc, char **argv)
 static void get_opts(int argc, char **argv)
 {
 	int opt = 0;
+	size_t len;
 
-	opt = getopt(argc, argv, opt_string);
+	opt = getopt_long(argc, argv, opt_string, long_opts, NULL);
 	while (opt != -1) {
 		switch(opt) {
 			case 'd':
@@ -205,11 +337,166 @@ static void get_opts(int argc, char **argv)
 			case 'v':
 				printf("%s\n", VERSION);
 				exit(0);
+			case OPT_WATCHDOG:
+				glob_args.watchdog = 1;
+				break;
+			case OPT_MAX_BLOCKED:
+				glob_args.max_blocked = atoi(optarg);
+				break;
+			case OPT_MAX_BLOCK_MS:
+				glob_args.max_block_ms = atoi(optarg);
+				break;
+			case OPT_SWAP_RETRIES:
+				glob_args.swap_retries = atoi(optarg);
+				break;
+			case OPT_PREWARM:
+				glob_args.prewarm = 1;
+				break;
+			case OPT_PREWARM_BUDGET:
+				glob_args.prewarm_budget = atol(optarg);
+				break;
+			case OPT_DAEMON:
+				glob_args.sock_path = optarg;
+				break;
+			case OPT_SCAN_INTERVAL:
+				glob_args.scan_interval = atoi(optarg);
+				break;
+			case OPT_SAMPLE_BLOAT:
+				glob_args.sample = 1;
+				break;
+			case OPT_SAMPLE_CI:
+				glob_args.sample_ci = atof(optarg);
+				break;
+			case OPT_SAMPLE_MAX:
+				glob_args.sample_max = atof(optarg);
+				break;
+			case OPT_VERIFY:
+				glob_args.verify = 1;
+				break;
+			case OPT_PROBE:
+				glob_args.probe_sql = optarg;
+				break;
+			case OPT_PROBE_RATE:
+				glob_args.probe_rate = atoi(optarg);
+				break;
+			case OPT_PROBE_BASELINE:
+				glob_args.probe_baseline = atoi(optarg);
+				break;
+			case OPT_AUTO_FILLFACTOR:
+				glob_args.auto_ff = 1;
+				break;
+			case OPT_HISTORY:
+				glob_args.history = optarg;
+				break;
+			case OPT_TS_HOT:
+				glob_args.ts_hot = optarg;
+				break;
+			case OPT_TS_COLD:
+				glob_args.ts_cold = optarg;
+				break;
+			case OPT_HOT_SCANS:
+				glob_args.hot_scans = atof(optarg);
+				break;
+			case OPT_HOT_READS:
+				glob_args.hot_reads = atof(optarg);
+				break;
+			case OPT_COLD_SCANS:
+				glob_args.cold_scans = atof(optarg);
+				break;
+			case OPT_RECONCILE:
+				glob_args.reconcile = 1;
+				break;
+			case OPT_XACT_POLICY:
+				if (!strcmp(optarg, "warn"))
+					glob_args.xact_policy = XACT_WARN;
+				else if (!strcmp(optarg, "defer"))
+					glob_args.xact_policy = XACT_DEFER;
+				else if (!strcmp(optarg, "terminate"))
+					glob_args.xact_policy = XACT_TERMINATE;
+				else
+					print_help(1);
+				break;
+			case OPT_XACT_MAX_AGE:
+				glob_args.xact_max_age = atoi(optarg);
+				break;
+			case OPT_DEFER_MAX:
+				glob_args.defer_max = atoi(optarg);
+				break;
+			case OPT_HEALTH:
+				glob_args.health = 1;
+				break;
+			case OPT_ANALYZE_HOST:
+				glob_args.ana_host = optarg;
+				break;
+			case OPT_MAX_LAG:
+				glob_args.max_lag = atoi(optarg);
+				break;
+			case OPT_POST_ANALYZE:
+				glob_args.post_analyze = 1;
+				break;
+			case OPT_VACUUM_DEAD:
+				glob_args.vacuum_dead = atof(optarg);
+				break;
+			case OPT_STANDBY:
+				if (glob_args.n_standbys == MAX_STANDBYS) {
+					fprintf(stderr, "Too many --standby, "
+						"at most %d\n", MAX_STANDBYS);
+					exit(1);
+				}
+				glob_args.standbys[glob_args.n_standbys++] = optarg;
+				break;
+			case OPT_USAGE_FILE:
+				glob_args.usage_file = optarg;
+				break;
+			case OPT_UNUSED_DAYS:
+				glob_args.unused_days = atoi(optarg);
+				break;
+			case OPT_TRACE:
+				glob_args.trace_file = optarg;
+				break;
+			case OPT_OBSERVE:
+				glob_args.observe = atoi(optarg);
+				break;
+			case OPT_JOBS:
+				glob_args.jobs = atoi(optarg);
+				if (glob_args.jobs < 1 ||
+				    glob_args.jobs > MAX_JOBS) {
+					fprintf(stderr, "--jobs must be "
+						"from 1 to %d\n", MAX_JOBS);
+					exit(1);
+				}
+				break;
+			case OPT_TOP:
+				glob_args.top = atoi(optarg);
+				if (glob_args.top < 1) {
+					fprintf(stderr, "--top must be "
+						"positive\n");
+					exit(1);
+				}
+				break;
+			case OPT_SCHEMA:
+				glob_args.schema = optarg;
+				break;
+			case OPT_EXCL_SCHEMA:
+				glob_args.excl_schema = optarg;
+				break;
+			case OPT_MIN_GAIN:
+				len = strlen(optarg);
+				if (len > 1 && optarg[len - 1] == '%' &&
+				    isdigit((unsigned char)*optarg))
+					glob_args.min_gain_pct = atof(optarg);
+				else if (!parse_size(optarg,
+						     &glob_args.min_gain)) {
+					fprintf(stderr, "--min-gain must be a "
+						"size or a percent\n");
+					exit(1);
+				}
+				break;
 			default:
 				break;
 		}
 
-		opt = getopt(argc, argv, opt_string);
+		opt = getopt_long(argc, argv, opt_string, long_opts, NULL);
 	}
 
 	if (argc < 4)
@@ -220,280 +507,753 @@ static void get_opts(int argc, char **argv)
 	if (!glob_args.db_name)
 		print_help(1);
 
-	if ((glob_args.stat || glob_args.size_thresh || glob_args.inval) &&
+	if ((glob_args.stat || glob_args.size_thresh || glob_args.inval ||
+	     glob_args.sample || glob_args.health) &&
 	    (glob_args.idx_name || glob_args.idx_filename))
 		print_help(1);
 
 	if (glob_args.idx_name && glob_args.idx_filename)
 		print_help(1);
+
+	if (glob_args.sock_path &&
+	    (glob_args.stat || glob_args.size_thresh || glob_args.inval ||
+	     glob_args.sample || glob_args.health ||
+	     glob_args.new_pref || glob_args.idx_name || glob_args.idx_filename))
+		print_help(1);
 }
 
 
 // exit_nicely(): close the connection to the database and exit
 static void exit_nicely(PGconn *conn)
 {
+	if (mon_conn)
+		PQfinish(mon_conn);
+	if (ver_conn)
+		PQfinish(ver_conn);
+	if (ana_conn && ana_conn != conn)
+		PQfinish(ana_conn);
 	PQfinish(conn);
+	trace_close();
 	exit(1);
 }
 
 
-// print_bloat_stat(): print bloat statistic
-// for top of 50 indexes by bloat size
-static void print_bloat_stat(PGconn *conn)
+// print_bloat_stat(): print top of bloated btree indexes, the
+// estimate is split into --jobs shards by the table oid that
+// run at the same time on clones of the connection
+static int print_bloat_stat(PGconn *conn)
 {
-	PGresult *res;
-	PQprintOpt option = {0};
+	PGconn *conns[MAX_JOBS];
+	struct bloat_heap_t heap = {0};
+	int n_conns = 1;
+	int ret, i;
+
+	conns[0] = conn;
+
+	for (i = 1; i < glob_args.jobs; i++) {
+		if ((conns[i] = clone_conn(conn)) == NULL) {
+			log_write(log_fp, WRN, "Bloat scan runs on %d "
+				  "connection(s) of %d\n", n_conns,
+				  glob_args.jobs);
+			break;
+		}
+		n_conns++;
+	}
 
-	res = PQexec(conn, IDX_BLOAT_STAT_SQL);
+	heap.max = glob_args.top;
+	heap.rows = (struct bloat_row_t*)malloc(heap.max *
+						sizeof(struct bloat_row_t));
 
-	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-		fprintf(stderr, "QUERY failed: %s\n",
-		        PQerrorMessage(conn));
-		PQclear(res);
-		exit_nicely(conn);
-	}
+	ret = run_bloat_shards(conns, n_conns, &heap);
 
-	if (!PQntuples(res))
-		printf("No bloated indexes found\n");
-	else {
-		option.header = 1;
-		option.align = 1;
-		option.fieldSep = "|";
+	for (i = 1; i < n_conns; i++)
+		PQfinish(conns[i]);
 
-		PQprint(stdout, res, &option);
+	if (ret != SUCCESS) {
+		free(heap.rows);
+		return FAIL;
 	}
 
-	PQclear(res);
-	exit_nicely(conn);
+	print_bloat_rows(&heap);
+	free(heap.rows);
+
+	// GIN, GiST, hash and BRIN indexes:
+	return print_am_bloat(conn);
 }
 
 
-// show_new_pref_idx(): show indexes with
-// the "new_" prefix in index names
-static void show_new_pref_idx(PGconn *conn)
+// clone_conn(): open one more connection with the
+// parameters of the passed one, NULL if it fails
+PGconn *clone_conn(PGconn *conn)
 {
-	PGresult *res;
-	PQprintOpt option = {0};
-
-	res = PQexec(conn, SHOW_NEW_PREF_IDX_SQL);
-
-	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-		fprintf(stderr, "QUERY failed: %s\n",
-                        PQerrorMessage(conn));
-		PQclear(res);
-		exit_nicely(conn);
+	PQconninfoOption *opts, *o;
+	const char *keys[64], *vals[64];
+	PGconn *new_conn;
+	int n = 0;
+
+	if ((opts = PQconninfo(conn)) == NULL)
+		return NULL;
+
+	for (o = opts; o->keyword && n < 63; o++) {
+		if (o->val == NULL || o->val[0] == '\0')
+			continue;
+		keys[n] = o->keyword;
+		vals[n++] = o->val;
 	}
+	keys[n] = NULL;
+	vals[n] = NULL;
 
-	if (!PQntuples(res))
-		printf("No \"new_\" indexes found\n");
-	else {
-		option.header = 1;
-		option.align = 1;
-		option.fieldSep = "|";
+	new_conn = PQconnectdbParams(keys, vals, 0);
+	PQconninfoFree(opts);
 
-		PQprint(stdout, res, &option);
+	if (PQstatus(new_conn) != CONNECTION_OK) {
+		log_write(log_fp, WRN, "Connection failed: %s\n",
+			  PQerrorMessage(new_conn));
+		PQfinish(new_conn);
+		return NULL;
 	}
 
-	PQclear(res);
-	exit_nicely(conn);
+	return new_conn;
 }
 
 
-// print_invalid_idx(): show invalid indexes
-static void print_invalid_idx(PGconn *conn)
+// run_bloat_shards(): send the shard i of n to the connection i,
+// wait for all of them and merge their rows into the heap
+int run_bloat_shards(PGconn **conns, int n, struct bloat_heap_t *heap)
 {
 	PGresult *res;
-	PQprintOpt option = {0};
+	struct bloat_row_t row;
+	const char *param_values[5];
+	char n_buf[16], shard_buf[16], top_buf[16];
+	int busy[MAX_JOBS];
+	int left = 0;
+	int ret = SUCCESS;
+	int i, j, sock, max_sock;
+	fd_set fds;
+
+	snprintf(n_buf, sizeof(n_buf), "%d", n);
+	snprintf(top_buf, sizeof(top_buf), "%d", heap->max);
+	param_values[0] = glob_args.schema;
+	param_values[1] = glob_args.excl_schema;
+	param_values[2] = n_buf;
+	param_values[3] = shard_buf;
+	param_values[4] = top_buf;
+
+	for (i = 0; i < n; i++) {
+		snprintf(shard_buf, sizeof(shard_buf), "%d", i);
+
+		busy[i] = PQsendQueryParams(conns[i], IDX_BLOAT_SHARD_SQL, 5,
+					    NULL, param_values, NULL, NULL, 0);
+		if (busy[i])
+			left++;
+		else {
+			fprintf(stderr, "QUERY failed: %s\n",
+				PQerrorMessage(conns[i]));
+			ret = FAIL;
+		}
+	}
 
-	res = PQexec(conn, GET_INV_IDX_SQL);
+	while (left > 0) {
+		FD_ZERO(&fds);
+		max_sock = -1;
+
+		for (i = 0; i < n; i++) {
+			if (!busy[i])
+				continue;
+			sock = PQsocket(conns[i]);
+			FD_SET(sock, &fds);
+			if (sock > max_sock)
+				max_sock = sock;
+		}
 
-	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-		fprintf(stderr, "QUERY failed: %s\n",
-                        PQerrorMessage(conn));
-		PQclear(res);
-		exit_nicely(conn);
-	}
+		if (select(max_sock + 1, &fds, NULL, NULL, NULL) < 0)
+			continue;
 
-	if (!PQntuples(res))
-		printf("No invalid indexes found\n");
-	else {
-		option.header = 1;
-		option.align = 1;
-		option.fieldSep = "|";
+		for (i = 0; i < n; i++) {
+			if (!busy[i] || !FD_ISSET(PQsocket(conns[i]), &fds))
+				continue;
 
-		PQprint(stdout, res, &option);
+			if (PQconsumeInput(conns[i]) && PQisBusy(conns[i]))
+				continue;
+
+			// The shard is done, take its rows:
+			while ((res = PQgetResult(conns[i])) != NULL) {
+				if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+					fprintf(stderr, "QUERY failed: %s\n",
+						PQerrorMessage(conns[i]));
+					ret = FAIL;
+				}
+
+				for (j = 0; ret == SUCCESS &&
+				     j < PQntuples(res); j++) {
+					snprintf(row.nsp, sizeof(row.nsp), "%s",
+						 PQgetvalue(res, j, 0));
+					snprintf(row.tbl, sizeof(row.tbl), "%s",
+						 PQgetvalue(res, j, 1));
+					snprintf(row.idx, sizeof(row.idx), "%s",
+						 PQgetvalue(res, j, 2));
+					row.size = atol(PQgetvalue(res, j, 3));
+					row.bloat = atol(PQgetvalue(res, j, 4));
+					snprintf(row.ratio, sizeof(row.ratio),
+						 "%s", PQgetvalue(res, j, 5));
+
+					bloat_heap_push(heap, &row);
+				}
+
+				PQclear(res);
+			}
+
+			busy[i] = 0;
+			left--;
+		}
 	}
 
-	PQclear(res);
-	exit_nicely(conn);
+	return ret;
 }
 
 
-// print_not_used(): print unused indexes with
-// size larger than threshold
-// and the scan counter less than scan_count
-static void print_not_used_idx(PGconn *conn,
-                               char *scan_count, char *threshold)
+// bloat_heap_push(): keep the row if it is among the
+// heap->max most bloated ones seen so far
+void bloat_heap_push(struct bloat_heap_t *heap, struct bloat_row_t *row)
 {
-	PGresult *res;
-	PQprintOpt option = {0};
-	const char *param_values[2];
+	struct bloat_row_t tmp;
+	int i, child;
+
+	if (heap->n < heap->max) {
+		// Sift the new row up:
+		i = heap->n++;
+		heap->rows[i] = *row;
+
+		while (i > 0 && heap->rows[(i - 1) / 2].bloat >
+				heap->rows[i].bloat) {
+			tmp = heap->rows[i];
+			heap->rows[i] = heap->rows[(i - 1) / 2];
+			heap->rows[(i - 1) / 2] = tmp;
+			i = (i - 1) / 2;
+		}
+		return;
+	}
 
-	param_values[0] = scan_count;
-	param_values[1] = threshold;
+	if (row->bloat <= heap->rows[0].bloat)
+		return;
 
-	res = PQexecParams(conn,
-			   GET_UNUSED_IDX_SQL,
-			   2,
-			   NULL,
-			   param_values,
-			   NULL,
-			   NULL,
-			   0);
+	// Replace the least bloated one and sift it down:
+	heap->rows[0] = *row;
+	i = 0;
 
-	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-		fprintf(stderr, "QUERY failed: %s\n", PQerrorMessage(conn));
-		PQclear(res);
-		exit_nicely(conn);
+	while ((child = 2 * i + 1) < heap->n) {
+		if (child + 1 < heap->n &&
+		    heap->rows[child + 1].bloat < heap->rows[child].bloat)
+			child++;
+		if (heap->rows[i].bloat <= heap->rows[child].bloat)
+			break;
+
+		tmp = heap->rows[i];
+		heap->rows[i] = heap->rows[child];
+		heap->rows[child] = tmp;
+		i = child;
 	}
+}
 
-	if (!PQntuples(res))
-		printf("Not used indexes not found.\n");
-	else {
-		option.header = 1;
-		option.align = 1;
-		option.fieldSep = "|";
 
-		PQprint(stdout, res, &option);
-	}
+// cmp_bloat_row(): the most bloated first
+int cmp_bloat_row(const void *a, const void *b)
+{
+	long x = ((const struct bloat_row_t*)a)->bloat;
+	long y = ((const struct bloat_row_t*)b)->bloat;
 
-	PQclear(res);
-	exit_nicely(conn);
+	return (x < y) - (x > y);
 }
 
 
-// get_rel_size(): get relation size
-unsigned get_rel_size(PGconn *conn, char *relname)
+// print_bloat_rows(): print the merged top like the
+// reports printed from a query result
+void print_bloat_rows(struct bloat_heap_t *heap)
 {
+	static char *cols[] = {"n", "schema", "tblname", "idxname",
+			       "size", "bloat_size", "bloat_ratio"};
+	PGresAttDesc attrs[7];
+	PQprintOpt option = {0};
 	PGresult *res;
-	unsigned size;
-	const char *param_values[1];
+	char buf[32];
+	int i;
 
-	param_values[0] = relname;
+	if (heap->n == 0) {
+		printf("No bloated indexes found\n");
+		return;
+	}
 
-	res = PQexecParams(conn,
-			   GET_REL_SIZE_SQL,
-			   1,
-			   NULL,
-			   param_values,
-			   NULL,
-			   NULL,
-			   0);
+	qsort(heap->rows, heap->n, sizeof(struct bloat_row_t), cmp_bloat_row);
 
-	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-		fprintf(stderr, "QUERY failed: %s\n", PQerrorMessage(conn));
+	memset(attrs, 0, sizeof(attrs));
+	for (i = 0; i < 7; i++) {
+		attrs[i].name = cols[i];
+		attrs[i].typid = 25;	// text
+		attrs[i].typlen = -1;
+		attrs[i].atttypmod = -1;
+	}
+
+	res = PQmakeEmptyPGresult(NULL, PGRES_TUPLES_OK);
+
+	if (!res || !PQsetResultAttrs(res, 7, attrs)) {
+		fprintf(stderr, "Can not make the result of bloat scan\n");
 		PQclear(res);
-		exit_nicely(conn);
+		return;
 	}
 
-	if (PQntuples(res)) 
-		size = atoi(PQgetvalue(res, 0, 0));
-	else
-		size = 0;
+	for (i = 0; i < heap->n; i++) {
+		snprintf(buf, sizeof(buf), "%d", i + 1);
+		PQsetvalue(res, i, 0, buf, -1);
+		PQsetvalue(res, i, 1, heap->rows[i].nsp, -1);
+		PQsetvalue(res, i, 2, heap->rows[i].tbl, -1);
+		PQsetvalue(res, i, 3, heap->rows[i].idx, -1);
+		format_size(heap->rows[i].size, buf, sizeof(buf));
+		PQsetvalue(res, i, 4, buf, -1);
+		format_size(heap->rows[i].bloat, buf, sizeof(buf));
+		PQsetvalue(res, i, 5, buf, -1);
+		PQsetvalue(res, i, 6, heap->rows[i].ratio, -1);
+	}
 
+	option.header = 1;
+	option.align = 1;
+	option.fieldSep = "|";
+
+	PQprint(stdout, res, &option);
 	PQclear(res);
-	return size;
 }
 
 
-/*
- * REBUILDING FUNCTIONS BELOW
- */
-
-// check_idx_name(): check a passed index name
-int check_idx_name(PGconn *conn, char *iname)
+// print_am_bloat(): print bloat of GIN, GiST and hash indexes
+// estimated from sampled pages, the pending list of GIN indexes
+// and the share of summarized page ranges of BRIN indexes
+static int print_am_bloat(PGconn *conn)
 {
 	PGresult *res;
-	const char *param_values[1];
-
-	// The index name is too long:
-	if (strlen(iname) > 63) 
-		return 2;
+	double bloat, ci, fill;
+	long nblocks, bsize, sampled, pending, summarized, ranges;
+	char size_buf[16], bloat_buf[16], pend_buf[16], cover_buf[16];
+	char *oid, *am;
+	int has_pgstattuple;
+	int i;
+
+	if (!check_extension(conn, "pageinspect")) {
+		printf("\nInstall the pageinspect extension to see "
+		       "GIN, GiST, hash and BRIN indexes\n");
+		return SUCCESS;
+	}
 
-	param_values[0] = iname;
+	has_pgstattuple = check_extension(conn, "pgstattuple");
 
-	res = PQexecParams(conn,
-			   CHECK_REL_EXIST_SQL,
-			   1,
-			   NULL,
-			   param_values,
-			   NULL,
-			   NULL,
-			   0);
+	res = get_sample_idx(conn, "{gin,gist,hash,brin}");
 
 	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-		log_write(log_fp, ERR, "QUERY failed: %s\n", PQerrorMessage(conn));
+		fprintf(stderr, "QUERY failed: %s\n",
+		        PQerrorMessage(conn));
 		PQclear(res);
-		exit_nicely(conn);
+		return FAIL;
 	}
 
 	if (!PQntuples(res)) {
+		printf("\nNo GIN, GiST, hash or BRIN indexes found\n");
 		PQclear(res);
-		return 0;  // Passed index not found
-	} else {
-		PQclear(res);
-		return 1;  // Index exists
+		return SUCCESS;
 	}
-}
 
+	srand(time(NULL) ^ getpid());
 
-// check_idx_validity(): check index validity
-int check_idx_validity(PGconn *conn, char *iname)
+	printf("\n%-5s|%-40s|%10s|%7s|%8s|%7s|%10s|%10s\n", "am", "idxname",
+	       "size", "fill %", "bloat %", "+/- %", "bloat_size", "pending");
+
+	for (i = 0; i < PQntuples(res); i++) {
+		oid = PQgetvalue(res, i, 0);
+		am = PQgetvalue(res, i, 5);
+		nblocks = atol(PQgetvalue(res, i, 2));
+		bsize = atol(PQgetvalue(res, i, 3));
+
+		format_size(nblocks * bsize, size_buf, sizeof(size_buf));
+
+		// BRIN is tiny, what matters is the range coverage:
+		if (!strcmp(am, "brin")) {
+			if (get_brin_coverage(conn, oid,
+					      atol(PQgetvalue(res, i, 6)),
+					      &summarized, &ranges) && ranges > 0)
+				snprintf(cover_buf, sizeof(cover_buf), "%.2f",
+					 100.0 * summarized / ranges);
+			else
+				snprintf(cover_buf, sizeof(cover_buf), "n/a");
+
+			printf("%-5s|%-40s|%10s| summarized ranges %%: %s\n",
+			       am, PQgetvalue(res, i, 1), size_buf, cover_buf);
+			continue;
+		}
+
+		if (!sample_idx_bloat(conn, oid, am, nblocks,
+				      atoi(PQgetvalue(res, i, 4)),
+				      &bloat, &ci, &fill, &sampled))
+			continue;
+
+		format_size((long)(nblocks * bsize * bloat / 100),
+			    bloat_buf, sizeof(bloat_buf));
+
+		if (!strcmp(am, "gin") && has_pgstattuple &&
+		    (pending = get_gin_pending(conn, oid)) >= 0)
+			format_size(pending * bsize, pend_buf, sizeof(pend_buf));
+		else
+			snprintf(pend_buf, sizeof(pend_buf), "%s",
+				 strcmp(am, "gin") ? "" : "n/a");
+
+		printf("%-5s|%-40s|%10s|%7.2f|%8.2f|%7.2f|%10s|%10s\n",
+		       am, PQgetvalue(res, i, 1), size_buf,
+		       fill, bloat, ci, bloat_buf, pend_buf);
+	}
+
+	PQclear(res);
+	return SUCCESS;
+}
+
+
+// get_gin_pending(): get the size of the GIN pending
+// list in pages, -1 on error
+long get_gin_pending(PGconn *conn, char *oid)
 {
 	PGresult *res;
 	const char *param_values[1];
+	long pending = -1;
 
-	param_values[0] = iname;
+	param_values[0] = oid;
 
-	res = PQexecParams(conn,
-			   CHECK_IDX_VALID_SQL,
-			   1,
-			   NULL,
-			   param_values,
-			   NULL,
-			   NULL,
-			   0);
+	res = PQexecParams(conn, GIN_PENDING_SQL, 1, NULL,
+			   param_values, NULL, NULL, 0);
 
-	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-		log_write(log_fp, ERR, "QUERY failed: %s\n",
+	if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res))
+		pending = atol(PQgetvalue(res, 0, 0));
+	else
+		log_write(log_fp, WRN, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+
+	PQclear(res);
+	return pending;
+}
+
+
+// get_brin_coverage(): count page ranges summarized by the
+// BRIN index and all page ranges of the table
+int get_brin_coverage(PGconn *conn, char *oid, long tbl_nblocks,
+		      long *summarized, long *ranges)
+{
+	PGresult *res;
+	const char *param_values[2];
+	char nblocks_str[24];
+	int ret = FAIL;
+
+	snprintf(nblocks_str, sizeof(nblocks_str), "%ld", tbl_nblocks);
+	param_values[0] = oid;
+	param_values[1] = nblocks_str;
+
+	res = PQexecParams(conn, BRIN_COVERAGE_SQL, 2, NULL,
+			   param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res)) {
+		*summarized = atol(PQgetvalue(res, 0, 0));
+		*ranges = atol(PQgetvalue(res, 0, 1));
+		ret = SUCCESS;
+	} else if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		log_write(log_fp, WRN, "QUERY failed: %s\n",
 			  PQerrorMessage(conn));
+
+	PQclear(res);
+	return ret;
+}
+
+
+// print_sampled_bloat(): print bloat of the --top largest btree
+// indexes of the --schema, estimated from a random sample of
+// pages read with pageinspect
+static int print_sampled_bloat(PGconn *conn)
+{
+	PGresult *res;
+	double bloat, ci, fill;
+	long nblocks, bsize, sampled;
+	char size_buf[16], bloat_buf[16];
+	int i;
+
+	if (!check_extension(conn, "pageinspect")) {
+		fprintf(stderr, "Extension pageinspect not found\n");
+		return FAIL;
+	}
+
+	res = get_sample_idx(conn, "{btree}");
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		fprintf(stderr, "QUERY failed: %s\n",
+		        PQerrorMessage(conn));
 		PQclear(res);
-		exit_nicely(conn);
+		return FAIL;
 	}
 
-	if (PQntuples(res)) {
+	if (!PQntuples(res)) {
+		printf("No indexes to sample found\n");
 		PQclear(res);
-		return 0;  // The index is invalid
-	} else {
+		return SUCCESS;
+	}
+
+	srand(time(NULL) ^ getpid());
+
+	printf("%-40s|%10s|%8s|%7s|%8s|%7s|%10s\n", "idxname", "size",
+	       "sampled", "fill %", "bloat %", "+/- %", "bloat_size");
+
+	for (i = 0; i < PQntuples(res); i++) {
+		nblocks = atol(PQgetvalue(res, i, 2));
+		bsize = atol(PQgetvalue(res, i, 3));
+
+		if (!sample_idx_bloat(conn, PQgetvalue(res, i, 0), "btree",
+				      nblocks, atoi(PQgetvalue(res, i, 4)),
+				      &bloat, &ci, &fill, &sampled))
+			continue;
+
+		format_size(nblocks * bsize, size_buf, sizeof(size_buf));
+		format_size((long)(nblocks * bsize * bloat / 100),
+			    bloat_buf, sizeof(bloat_buf));
+
+		printf("%-40s|%10s|%8ld|%7.2f|%8.2f|%7.2f|%10s\n",
+		       PQgetvalue(res, i, 1), size_buf, sampled,
+		       fill, bloat, ci, bloat_buf);
+	}
+
+	PQclear(res);
+	return SUCCESS;
+}
+
+
+// get_sample_idx(): the --top largest indexes of the access
+// methods in the array literal ams in the report schemas
+PGresult *get_sample_idx(PGconn *conn, char *ams)
+{
+	const char *param_values[4];
+	char top_buf[16];
+
+	snprintf(top_buf, sizeof(top_buf), "%d", glob_args.top);
+	param_values[0] = glob_args.schema;
+	param_values[1] = glob_args.excl_schema;
+	param_values[2] = ams;
+	param_values[3] = top_buf;
+
+	return PQexecParams(conn, GET_SAMPLE_IDX_SQL, 4, NULL,
+			    param_values, NULL, NULL, 0);
+}
+
+
+// sample_idx_bloat(): estimate the bloat of the btree, GIN, GiST
+// or hash index (in % of its size) from randomly chosen pages:
+// leaf pages of btree, leaf pages of GIN entry and posting trees,
+// all GiST pages and bucket/overflow hash pages. Sampling stops
+// when the 95% confidence interval is narrower than --sample-ci
+// or when --sample-max percent of pages have been read
+int sample_idx_bloat(PGconn *conn, char *oid, char *am, long nblocks,
+		     int fillfactor, double *bloat, double *ci, double *fill,
+		     long *sampled)
+{
+	PGresult *res;
+	struct run_stat_t free_st;
+	const char *param_values[2];
+	char *blocks, *type, *sql;
+	long max_pages, leaves = 0, batch, pos;
+	double ideal_free, scale = 0;
+	int i;
+
+	*sampled = 0;
+	*bloat = *ci = *fill = 0;
+
+	if (nblocks < 2)
+		return FAIL;
+
+	if (!strcmp(am, "btree"))
+		sql = SAMPLE_BT_PAGES_SQL;
+	else if (!strcmp(am, "gin"))
+		sql = SAMPLE_GIN_PAGES_SQL;
+	else if (!strcmp(am, "gist"))
+		sql = SAMPLE_GIST_PAGES_SQL;
+	else if (!strcmp(am, "hash"))
+		sql = SAMPLE_HASH_PAGES_SQL;
+	else
+		return FAIL;
+
+	max_pages = (long)(nblocks * glob_args.sample_max / 100);
+	if (max_pages < SMP_MIN_PAGES)
+		max_pages = SMP_MIN_PAGES;
+	if (max_pages > nblocks - 1)
+		max_pages = nblocks - 1;
+
+	// Free space a freshly built leaf page has:
+	ideal_free = (100 - fillfactor) / 100.0;
+
+	run_stat_init(&free_st);
+
+	// "{" + SMP_BATCH numbers of up to 10 digits and commas + "}"
+	blocks = (char*)malloc((SMP_BATCH * 11 + 3) * sizeof(char));
+
+	while (*sampled < max_pages) {
+		batch = max_pages - *sampled;
+		if (batch > SMP_BATCH)
+			batch = SMP_BATCH;
+
+		pos = sprintf(blocks, "{");
+		for (i = 0; i < batch; i++)
+			pos += sprintf(blocks + pos, i ? ",%ld" : "%ld",
+				       rand_block(nblocks));
+		sprintf(blocks + pos, "}");
+
+		param_values[0] = oid;
+		param_values[1] = blocks;
+
+		res = PQexecParams(conn, sql, 2, NULL,
+				   param_values, NULL, NULL, 0);
+
+		if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+			log_write(log_fp, ERR, "QUERY failed: %s\n",
+				  PQerrorMessage(conn));
+			PQclear(res);
+			free(blocks);
+			return FAIL;
+		}
+
+		for (i = 0; i < PQntuples(res); i++) {
+			type = PQgetvalue(res, i, 0);
+
+			// Deleted and half-dead pages are free entirely,
+			// the root and inner pages are left out:
+			if (type[0] == 'l') {
+				run_stat_add(&free_st,
+					     atof(PQgetvalue(res, i, 1)) /
+					     atof(PQgetvalue(res, i, 2)));
+				leaves++;
+			} else if (type[0] == 'd' || type[0] == 'e') {
+				run_stat_add(&free_st, 1);
+				leaves++;
+			}
+		}
+
+		*sampled += batch;
 		PQclear(res);
-		return 1;  // The index is valid
+
+		if (free_st.n < SMP_MIN_PAGES / 2)
+			continue;
+
+		// Leaf pages beyond those needed at the ideal fill,
+		// in percent of the whole index:
+		scale = 100.0 * leaves / *sampled / (1 - ideal_free);
+		*ci = run_stat_ci(&free_st) * scale;
+
+		if (*ci <= glob_args.sample_ci)
+			break;
+	}
+
+	free(blocks);
+
+	if (!free_st.n)
+		return FAIL;
+
+	if (scale == 0) {
+		scale = 100.0 * leaves / *sampled / (1 - ideal_free);
+		*ci = run_stat_ci(&free_st) * scale;
 	}
+
+	*fill = 100 * (1 - free_st.mean);
+	*bloat = free_st.mean > ideal_free ?
+		 (free_st.mean - ideal_free) * scale : 0;
+
+	return SUCCESS;
 }
 
 
-// get_indexdef(): get the definition of
-// the index from pg_indexes
-char *get_indexdef(PGconn *conn, char *iname)
+// rand_block(): random block number from 1 to nblocks - 1,
+// block 0 is the metapage of btree, GIN and hash (and the
+// root of GiST)
+long rand_block(long nblocks)
+{
+	long r = ((long)rand() << 31) ^ rand();
+
+	return 1 + r % (nblocks - 1);
+}
+
+
+// show_new_pref_idx(): show indexes with
+// the "new_" prefix in index names
+static int show_new_pref_idx(PGconn *conn)
 {
 	PGresult *res;
-	const char *param_values[1];
-	char *idef;
+	PQprintOpt option = {0};
 
-	param_values[0] = iname;
+	res = PQexec(conn, SHOW_NEW_PREF_IDX_SQL);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		fprintf(stderr, "QUERY failed: %s\n",
+                        PQerrorMessage(conn));
+		PQclear(res);
+		return FAIL;
+	}
+
+	if (!PQntuples(res))
+		printf("No \"new_\" indexes found\n");
+	else {
+		option.header = 1;
+		option.align = 1;
+		option.fieldSep = "|";
+
+		PQprint(stdout, res, &option);
+	}
+
+	PQclear(res);
+	return SUCCESS;
+}
+
+
+// print_invalid_idx(): show invalid indexes
+static int print_invalid_idx(PGconn *conn)
+{
+	PGresult *res;
+	PQprintOpt option = {0};
+
+	res = PQexec(conn, GET_INV_IDX_SQL);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		fprintf(stderr, "QUERY failed: %s\n",
+                        PQerrorMessage(conn));
+		PQclear(res);
+		return FAIL;
+	}
+
+	if (!PQntuples(res))
+		printf("No invalid indexes found\n");
+	else {
+		option.header = 1;
+		option.align = 1;
+		option.fieldSep = "|";
+
+		PQprint(stdout, res, &option);
+	}
+
+	PQclear(res);
+	return SUCCESS;
+}
+
+
+// print_not_used(): print unused indexes with
+// size larger than threshold
+// and the scan counter less than scan_count
+static int print_not_used_idx(PGconn *conn,
+                              char *scan_count, char *threshold)
+{
+	PGresult *res;
+	PQprintOpt option = {0};
+	const char *param_values[2];
+
+	param_values[0] = scan_count;
+	param_values[1] = threshold;
 
 	res = PQexecParams(conn,
-			   GET_IDXDEF_SQL,
-			   1,
+			   GET_UNUSED_IDX_SQL,
+			   2,
 			   NULL,
 			   param_values,
 			   NULL,
@@ -501,378 +1261,4105 @@ char *get_indexdef(PGconn *conn, char *iname)
 			   0);
 
 	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-		log_write(log_fp, ERR, "QUERY failed: %s\n", PQerrorMessage(conn));
+		fprintf(stderr, "QUERY failed: %s\n", PQerrorMessage(conn));
 		PQclear(res);
-		exit_nicely(conn);
+		return FAIL;
 	}
 
-	if (PQntuples(res)) {
-		idef = (char *)malloc(strlen(PQgetvalue(res, 0, 0)) * sizeof(char) + 1);
-		strcpy(idef, PQgetvalue(res, 0, 0));
+	if (!PQntuples(res))
+		printf("Not used indexes not found.\n");
+	else {
+		option.header = 1;
+		option.align = 1;
+		option.fieldSep = "|";
+
+		PQprint(stdout, res, &option);
+	}
+
+	PQclear(res);
+	return SUCCESS;
+}
+
+// print_unused_agg(): print indexes unused on the primary and
+// all --standby servers for --unused-days. Scan counters of
+// each server are accumulated in the usage file, so statistic
+// resets do not lose the history. Nothing is reported unless
+// every server has been read, an index could serve a standby
+static int print_unused_agg(PGconn *conn, char *threshold)
+{
+	PGresult *res;
+	PGconn *sconn;
+	struct usage_rec_t *recs = NULL;
+	struct usage_rec_t *rec, *end, key;
+	const char *param_values[1];
+	char size_buf[16];
+	long now = (long)time(NULL);
+	long scans, idle, min_idle;
+	int n = 0, i, unused, found = 0, complete = 1;
+
+	load_usage(&recs, &n);
+	qsort(recs, n, sizeof(struct usage_rec_t), cmp_usage_rec);
+
+	if (!collect_usage(conn, PQdb(conn), &recs, &n, now))
+		complete = 0;
+
+	for (i = 0; i < glob_args.n_standbys; i++) {
+		sconn = PQconnectdb(glob_args.standbys[i]);
+
+		if (PQstatus(sconn) != CONNECTION_OK ||
+		    !collect_usage(sconn, PQdb(conn), &recs, &n, now)) {
+			fprintf(stderr, "Standby %d is not read: %s\n",
+				i + 1, PQerrorMessage(sconn));
+			log_write(log_fp, ERR, "Standby %d is not read: %s\n",
+				  i + 1, PQerrorMessage(sconn));
+			complete = 0;
+		}
+
+		PQfinish(sconn);
+	}
+
+	save_usage(recs, n);
+
+	if (!complete) {
+		printf("Not all servers are read, unused indexes "
+		       "are not reported\n");
+		free(recs);
+		return SUCCESS;
+	}
+
+	param_values[0] = threshold;
+
+	res = PQexecParams(conn, GET_UNUSED_CAND_SQL, 1, NULL,
+			   param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		fprintf(stderr, "QUERY failed: %s\n", PQerrorMessage(conn));
 		PQclear(res);
-	} else 
-		idef = NULL;  // No indexdef found
+		free(recs);
+		return FAIL;
+	}
+
+	snprintf(key.db, sizeof(key.db), "%s", PQdb(conn));
+	end = recs + n;
+
+	for (i = 0; i < PQntuples(res); i++) {
+		key.oid = atol(PQgetvalue(res, i, 0));
+		scans = 0;
+		min_idle = -1;
+		unused = 1;
+
+		// Records of the index on all servers are adjacent:
+		rec = (struct usage_rec_t*)bsearch(&key, recs, n,
+				sizeof(struct usage_rec_t), cmp_usage_oid);
+		while (rec && rec > recs && !cmp_usage_oid(&key, rec - 1))
+			rec--;
+
+		// Unused on every server that has seen the index:
+		for (; rec && rec < end && unused &&
+		     !cmp_usage_oid(&key, rec); rec++) {
+			idle = now - (rec->last_used ? rec->last_used :
+						       rec->first_seen);
+			scans += rec->total;
+
+			if (idle < glob_args.unused_days * 86400L ||
+			    (!glob_args.unused_days && rec->last_used))
+				unused = 0;
+			else if (min_idle < 0 || idle < min_idle)
+				min_idle = idle;
+		}
+
+		if (!unused || min_idle < 0)
+			continue;
+
+		if (!found)
+			printf("%-40s|%-30s|%10s|%8s|%9s\n", "index_name",
+			       "table_name", "size", "scans", "idle_days");
+
+		format_size(atol(PQgetvalue(res, i, 3)), size_buf,
+			    sizeof(size_buf));
+		printf("%-40s|%-30s|%10s|%8ld|%9ld\n", PQgetvalue(res, i, 1),
+		       PQgetvalue(res, i, 2), size_buf, scans,
+		       min_idle / 86400);
+		found++;
+	}
+
+	if (!found)
+		printf("Not used indexes not found.\n");
+
+	PQclear(res);
+	free(recs);
+	return SUCCESS;
+}
+
+
+// collect_usage(): add scan counters of the server to the
+// usage records of the database db of the primary, standbys
+// may be reached by another dbname or a service alias; a
+// counter less than the last one means the statistic was reset
+int collect_usage(PGconn *conn, char *db, struct usage_rec_t **recs,
+		  int *n, long now)
+{
+	PGresult *res;
+	struct usage_rec_t *rec;
+	char node[128];
+	long scan;
+	int i, n_sorted = *n;
+
+	snprintf(node, sizeof(node), "%s:%s", PQhost(conn), PQport(conn));
+
+	res = PQexec(conn, GET_IDX_USAGE_SQL);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return FAIL;
+	}
+
+	for (i = 0; i < PQntuples(res); i++) {
+		scan = atol(PQgetvalue(res, i, 1));
+		rec = get_usage_rec(recs, n, n_sorted, db, node,
+				    atol(PQgetvalue(res, i, 0)));
+
+		if (!rec->first_seen) {
+			// Scans before the first check are recent for all we know:
+			rec->first_seen = now;
+			rec->last_used = scan > 0 ? now : 0;
+		} else if (scan != rec->last_scan) {
+			rec->total += scan > rec->last_scan ?
+				      scan - rec->last_scan : scan;
+			if (scan > 0)
+				rec->last_used = now;
+		}
+
+		rec->last_scan = scan;
+	}
+
+	// Keep the records sorted for the next server:
+	qsort(*recs, *n, sizeof(struct usage_rec_t), cmp_usage_rec);
+
+	log_write(log_fp, INF, "Usage of %d index(es) collected from %s\n",
+		  PQntuples(res), node);
+
+	PQclear(res);
+	return SUCCESS;
+}
+
+
+// get_usage_rec(): find the record of the index on the
+// server among the first n_sorted records (sorted by
+// cmp_usage_rec) or add a new one to the end
+struct usage_rec_t *get_usage_rec(struct usage_rec_t **recs, int *n,
+				  int n_sorted, char *db, char *node, long oid)
+{
+	struct usage_rec_t *rec, key;
+
+	snprintf(key.db, sizeof(key.db), "%s", db);
+	snprintf(key.node, sizeof(key.node), "%s", node);
+	key.oid = oid;
+
+	rec = (struct usage_rec_t*)bsearch(&key, *recs, n_sorted,
+					   sizeof(struct usage_rec_t),
+					   cmp_usage_rec);
+	if (rec)
+		return rec;
+
+	*recs = (struct usage_rec_t*)realloc(*recs, (*n + 1) *
+					     sizeof(struct usage_rec_t));
+	rec = &(*recs)[(*n)++];
+
+	memset(rec, 0, sizeof(struct usage_rec_t));
+	snprintf(rec->db, sizeof(rec->db), "%s", db);
+	snprintf(rec->node, sizeof(rec->node), "%s", node);
+	rec->oid = oid;
+
+	return rec;
+}
+
+
+// cmp_usage_oid(): order usage records by the database
+// and the index oid
+int cmp_usage_oid(const void *a, const void *b)
+{
+	const struct usage_rec_t *x = (const struct usage_rec_t*)a;
+	const struct usage_rec_t *y = (const struct usage_rec_t*)b;
+	int ret;
+
+	if ((ret = strcmp(x->db, y->db)) != 0)
+		return ret;
+
+	return (x->oid > y->oid) - (x->oid < y->oid);
+}
+
+
+// cmp_usage_rec(): order usage records by the database,
+// the index oid and the server
+int cmp_usage_rec(const void *a, const void *b)
+{
+	int ret;
+
+	if ((ret = cmp_usage_oid(a, b)) != 0)
+		return ret;
+
+	return strcmp(((const struct usage_rec_t*)a)->node,
+		      ((const struct usage_rec_t*)b)->node);
+}
+
+
+// load_usage(): read the usage file, lines are
+// "db node oid last_scan total last_used first_seen"
+int load_usage(struct usage_rec_t **recs, int *n)
+{
+	FILE *fp;
+	struct usage_rec_t rec;
+
+	if ((fp = fopen(glob_args.usage_file, "r")) == NULL)
+		return FAIL;
+
+	while (fscanf(fp, "%67s %127s %ld %ld %ld %ld %ld", rec.db, rec.node,
+		      &rec.oid, &rec.last_scan, &rec.total, &rec.last_used,
+		      &rec.first_seen) == 7) {
+		*recs = (struct usage_rec_t*)realloc(*recs, (*n + 1) *
+						     sizeof(struct usage_rec_t));
+		(*recs)[(*n)++] = rec;
+	}
+
+	fclose(fp);
+	return SUCCESS;
+}
+
+
+// save_usage(): rewrite the usage file
+void save_usage(struct usage_rec_t *recs, int n)
+{
+	FILE *fp;
+	char tmp_name[256];
+	int i;
+
+	snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", glob_args.usage_file);
+
+	if ((fp = fopen(tmp_name, "w")) == NULL) {
+		log_write(log_fp, WRN, "Could not open the usage file %s\n",
+			  tmp_name);
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+		fprintf(fp, "%s %s %ld %ld %ld %ld %ld\n", recs[i].db,
+			recs[i].node, recs[i].oid, recs[i].last_scan,
+			recs[i].total, recs[i].last_used, recs[i].first_seen);
+
+	fclose(fp);
+
+	if (rename(tmp_name, glob_args.usage_file) != 0)
+		log_write(log_fp, WRN, "Could not write the usage file %s\n",
+			  glob_args.usage_file);
+}
+
+
+// print_health(): print the bloat, invalid, unused and "new_"
+// reports as one JSON document. All of them are derived from
+// one query, so they see the same snapshot of the catalogs.
+// Unused indexes are larger than -u SIZE_THRESH if it is given.
+// If the snapshot is taken on the standby (aconn), scan counters
+// are taken from the primary and matched by the index oid
+static int print_health(PGconn *aconn, PGconn *conn)
+{
+	PGresult *res, *usage_res = NULL;
+	struct health_row_t *bloated;
+	struct idx_usage_t *usage = NULL;
+	struct idx_usage_t key, *found;
+	const char *param_values[2];
+	long size, thresh, idx_scan;
+	int i, n = 0, n_usage = 0, first;
+
+	param_values[0] = glob_args.schema;
+	param_values[1] = glob_args.excl_schema;
+	res = PQexecParams(aconn, HEALTH_SNAPSHOT_SQL, 2, NULL,
+			   param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		fprintf(stderr, "QUERY failed: %s\n",
+			PQerrorMessage(aconn));
+		PQclear(res);
+		return FAIL;
+	}
+
+	if (aconn != conn) {
+		usage_res = PQexec(conn, GET_IDX_USAGE_SQL);
+
+		if (PQresultStatus(usage_res) != PGRES_TUPLES_OK) {
+			fprintf(stderr, "QUERY failed: %s\n",
+				PQerrorMessage(conn));
+			PQclear(usage_res);
+			PQclear(res);
+			return FAIL;
+		}
+
+		n_usage = PQntuples(usage_res);
+		usage = (struct idx_usage_t*)malloc((n_usage + 1) *
+						    sizeof(struct idx_usage_t));
+
+		for (i = 0; i < n_usage; i++) {
+			usage[i].oid = atol(PQgetvalue(usage_res, i, 0));
+			usage[i].idx_scan = atol(PQgetvalue(usage_res, i, 1));
+		}
+
+		qsort(usage, n_usage, sizeof(struct idx_usage_t),
+		      cmp_idx_usage);
+		PQclear(usage_res);
+	}
+
+	thresh = glob_args.size_thresh ? atol(glob_args.size_thresh) : 0;
+
+	// Bloated btree indexes of -s, the largest bloat first:
+	bloated = (struct health_row_t*)malloc((PQntuples(res) + 1) *
+					       sizeof(struct health_row_t));
+
+	for (i = 0; i < PQntuples(res); i++) {
+		if (PQgetisnull(res, i, 8))
+			continue;
+
+		bloated[n].row = i;
+		bloated[n].bloat = atol(PQgetvalue(res, i, 8));
+		n++;
+	}
+
+	qsort(bloated, n, sizeof(struct health_row_t), cmp_health_row);
+
+	printf("{\n  \"database\": ");
+	print_json_str(stdout, PQdb(conn));
+	printf(",\n  \"indexes\": %d,\n  \"bloat\": [", PQntuples(res));
+
+	for (i = 0; i < n && i < glob_args.top; i++) {
+		size = atol(PQgetvalue(res, bloated[i].row, 3));
+
+		printf(i ? ",\n    " : "\n    ");
+		print_health_idx(res, bloated[i].row);
+		printf(", \"bloat_size\": %ld, \"bloat_ratio\": %.2f}",
+		       bloated[i].bloat,
+		       size > 0 ? 100.0 * bloated[i].bloat / size : 0);
+	}
+	free(bloated);
+
+	printf("%s],\n  \"invalid\": [", n ? "\n  " : "");
+
+	for (i = 0, first = 1; i < PQntuples(res); i++) {
+		if (PQgetvalue(res, i, 4)[0] == 't')
+			continue;
+
+		printf(first ? "\n    " : ",\n    ");
+		print_health_idx(res, i);
+		printf("}");
+		first = 0;
+	}
+
+	printf("%s],\n  \"unused\": [", first ? "" : "\n  ");
+
+	for (i = 0, first = 1; i < PQntuples(res); i++) {
+		if (usage) {
+			// Indexes unknown to the primary were dropped there,
+			// the drop is not replayed on the standby yet:
+			key.oid = atol(PQgetvalue(res, i, 9));
+			found = (struct idx_usage_t*)bsearch(&key, usage,
+					n_usage, sizeof(struct idx_usage_t),
+					cmp_idx_usage);
+			if (!found)
+				continue;
+			idx_scan = found->idx_scan;
+		} else if (PQgetisnull(res, i, 6))
+			continue;
+		else
+			idx_scan = atol(PQgetvalue(res, i, 6));
+
+		if (idx_scan > 0 || PQgetvalue(res, i, 5)[0] == 't' ||
+		    atol(PQgetvalue(res, i, 3)) <= thresh)
+			continue;
+
+		printf(first ? "\n    " : ",\n    ");
+		print_health_idx(res, i);
+		printf(", \"idx_scan\": %ld}", idx_scan);
+		first = 0;
+	}
+
+	free(usage);
+
+	printf("%s],\n  \"new_prefix\": [", first ? "" : "\n  ");
+
+	for (i = 0, first = 1; i < PQntuples(res); i++) {
+		if (strncmp(PQgetvalue(res, i, 2), "new_", 4))
+			continue;
+
+		printf(first ? "\n    " : ",\n    ");
+		print_health_idx(res, i);
+		printf(", \"valid\": %s}",
+		       PQgetvalue(res, i, 4)[0] == 't' ? "true" : "false");
+		first = 0;
+	}
+
+	printf("%s]\n}\n", first ? "" : "\n  ");
+
+	PQclear(res);
+	return SUCCESS;
+}
+
+
+// print_health_idx(): print the common fields of the
+// index in the row of the health snapshot, leave the
+// JSON object open
+static void print_health_idx(PGresult *res, int row)
+{
+	printf("{\"schema\": ");
+	print_json_str(stdout, PQgetvalue(res, row, 0));
+	printf(", \"table\": ");
+	print_json_str(stdout, PQgetvalue(res, row, 1));
+	printf(", \"index\": ");
+	print_json_str(stdout, PQgetvalue(res, row, 2));
+	printf(", \"am\": ");
+	print_json_str(stdout, PQgetvalue(res, row, 7));
+	printf(", \"size\": %s", PQgetvalue(res, row, 3));
+}
+
+
+// cmp_idx_usage(): order usage counters by the index oid
+int cmp_idx_usage(const void *a, const void *b)
+{
+	long x = ((const struct idx_usage_t*)a)->oid;
+	long y = ((const struct idx_usage_t*)b)->oid;
+
+	return (x > y) - (x < y);
+}
+
+
+// get_ana_conn(): the connection for read-only analysis. It is
+// the standby of --analyze-host if its replay lag is below
+// --max-lag, NULL if it is not usable, and the main connection
+// without --analyze-host
+PGconn *get_ana_conn(PGconn *conn)
+{
+	double lag;
+
+	if (!glob_args.ana_host)
+		return conn;
+
+	if (!ana_conn) {
+		ana_conn = PQconnectdb(glob_args.ana_host);
+
+		if (PQstatus(ana_conn) != CONNECTION_OK) {
+			log_write(log_fp, ERR,
+				  "Connection to analysis host failed: %s\n",
+				  PQerrorMessage(ana_conn));
+			PQfinish(ana_conn);
+			ana_conn = NULL;
+			return NULL;
+		}
+
+		log_write(log_fp, INF, "Analysis connection established\n");
+	}
+
+	if ((lag = get_replay_lag(ana_conn)) < 0)
+		return NULL;
+
+	if (lag > glob_args.max_lag) {
+		log_write(log_fp, WRN,
+			  "Replay lag of analysis host is %f sec, "
+			  "its results are discarded\n", lag);
+		return NULL;
+	}
+
+	return ana_conn;
+}
+
+
+// get_replay_lag(): get the replay lag of the standby in
+// seconds, -1 if it is unknown
+double get_replay_lag(PGconn *conn)
+{
+	PGresult *res;
+	double lag;
+
+	if (PQserverVersion(conn) >= 100000)
+		res = PQexec(conn, GET_REPLAY_LAG_SQL);
+	else
+		res = PQexec(conn, GET_XLOG_REPLAY_LAG_SQL);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK || !PQntuples(res)) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return -1;
+	}
+
+	if (PQgetvalue(res, 0, 0)[0] != 't')
+		log_write(log_fp, WRN, "Analysis host is not a standby\n");
+
+	lag = atof(PQgetvalue(res, 0, 1));
+
+	PQclear(res);
+	return lag;
+}
+
+
+// cmp_health_row(): order rows by bloat, descending
+int cmp_health_row(const void *a, const void *b)
+{
+	long x = ((const struct health_row_t*)a)->bloat;
+	long y = ((const struct health_row_t*)b)->bloat;
+
+	return (x < y) - (x > y);
+}
+
+
+// get_rel_size(): get relation size
+long get_rel_size(PGconn *conn, char *relname)
+{
+	PGresult *res;
+	long size;
+	const char *param_values[1];
+
+	param_values[0] = relname;
+
+	res = PQexecParams(conn,
+			   GET_REL_SIZE_SQL,
+			   1,
+			   NULL,
+			   param_values,
+			   NULL,
+			   NULL,
+			   0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return -1;
+	}
+
+	if (PQntuples(res)) 
+		size = atol(PQgetvalue(res, 0, 0));
+	else
+		size = 0;
+
+	PQclear(res);
+	return size;
+}
+
+
+// estimate_gain(): estimate the bytes the rebuild reclaims,
+// from pg_stats for btree or from sampled pages (needs
+// pageinspect) for other access methods and btree indexes
+// without statistics. Returns -1 if it is unknown. With
+// --analyze-host the estimate runs on the standby by the oid
+// of the index on the primary, so an index the standby has
+// not replayed yet is not mistaken for an older one
+long estimate_gain(PGconn *conn, struct rebuild_t *rb)
+{
+	PGresult *res;
+	PGconn *pconn = conn;
+	const char *param_values[1];
+	double bloat, ci, fill;
+	long sampled, gain = -1;
+	char oid_buf[16];
+
+	param_values[0] = rb->iname;
+
+	if (glob_args.ana_host) {
+		if ((conn = get_ana_conn(pconn)) == NULL) {
+			log_write(log_fp, WRN,
+				  "Estimate the gain on the primary\n");
+			conn = pconn;
+		} else {
+			res = PQexecParams(pconn, GET_IDX_OID_SQL, 1, NULL,
+					   param_values, NULL, NULL, 0);
+
+			if (PQresultStatus(res) != PGRES_TUPLES_OK ||
+			    !PQntuples(res)) {
+				log_write(log_fp, WRN, "QUERY failed: %s\n",
+					  PQerrorMessage(pconn));
+				PQclear(res);
+				return -1;
+			}
+
+			snprintf(oid_buf, sizeof(oid_buf), "%s",
+				 PQgetvalue(res, 0, 0));
+			param_values[0] = oid_buf;
+			PQclear(res);
+		}
+	}
+
+	if (!strcmp(rb->idx_am, "btree")) {
+		res = PQexecParams(conn, IDX_GAIN_EST_SQL, 1, NULL,
+				   param_values, NULL, NULL, 0);
+
+		if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res))
+			gain = atol(PQgetvalue(res, 0, 1));
+		else if (PQresultStatus(res) != PGRES_TUPLES_OK)
+			log_write(log_fp, WRN, "QUERY failed: %s\n",
+				  PQerrorMessage(conn));
+		PQclear(res);
+
+		if (gain >= 0)
+			return gain;
+	}
+
+	if (!strcmp(rb->idx_am, "brin") || !check_extension(conn, "pageinspect"))
+		return -1;
+
+	res = PQexecParams(conn, GET_IDX_SAMPLE_SQL, 1, NULL,
+			   param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK || !PQntuples(res)) {
+		log_write(log_fp, WRN, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return -1;
+	}
+
+	if (sample_idx_bloat(conn, PQgetvalue(res, 0, 0), rb->idx_am,
+			     atol(PQgetvalue(res, 0, 1)),
+			     atoi(PQgetvalue(res, 0, 2)),
+			     &bloat, &ci, &fill, &sampled)) {
+		gain = bloat > 0 ? (long)(bloat / 100 * rb->prev_size) : 0;
+		log_write(log_fp, INF,
+			  "Sampled %ld pages: bloat %f%% +/- %f%%\n",
+			  sampled, bloat, ci);
+	}
+
+	PQclear(res);
+	return gain;
+}
+
+
+/*
+ * REBUILDING FUNCTIONS BELOW
+ */
+
+// check_extension(): check the extension is installed
+int check_extension(PGconn *conn, char *extname)
+{
+	PGresult *res;
+	const char *param_values[1];
+	int ret;
+
+	param_values[0] = extname;
+
+	res = PQexecParams(conn,
+			   CHECK_EXTENSION_SQL,
+			   1,
+			   NULL,
+			   param_values,
+			   NULL,
+			   NULL,
+			   0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return FAIL;
+	}
+
+	ret = PQntuples(res) ? SUCCESS : FAIL;
+
+	PQclear(res);
+	return ret;
+}
+
+// check_idx_name(): check a passed index name
+int check_idx_name(PGconn *conn, char *iname)
+{
+	PGresult *res;
+	const char *param_values[1];
+
+	// The index name is too long:
+	if (strlen(iname) > 63) 
+		return 2;
+
+	param_values[0] = iname;
+
+	res = PQexecParams(conn,
+			   CHECK_REL_EXIST_SQL,
+			   1,
+			   NULL,
+			   param_values,
+			   NULL,
+			   NULL,
+			   0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n", PQerrorMessage(conn));
+		PQclear(res);
+		return QUERY_ERR;
+	}
+
+	if (!PQntuples(res)) {
+		PQclear(res);
+		return 0;  // Passed index not found
+	} else {
+		PQclear(res);
+		return 1;  // Index exists
+	}
+}
+
+
+// check_idx_validity(): check index validity
+int check_idx_validity(PGconn *conn, char *iname)
+{
+	PGresult *res;
+	const char *param_values[1];
+
+	param_values[0] = iname;
+
+	res = PQexecParams(conn,
+			   CHECK_IDX_VALID_SQL,
+			   1,
+			   NULL,
+			   param_values,
+			   NULL,
+			   NULL,
+			   0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return QUERY_ERR;
+	}
+
+	if (PQntuples(res)) {
+		PQclear(res);
+		return 0;  // The index is invalid
+	} else {
+		PQclear(res);
+		return 1;  // The index is valid
+	}
+}
+
+
+// get_idx_am(): get the access method name of the index
+char *get_idx_am(PGconn *conn, char *iname)
+{
+	PGresult *res;
+	const char *param_values[1];
+	char *am = NULL;
+
+	param_values[0] = iname;
+
+	res = PQexecParams(conn,
+			   GET_IDX_AM_SQL,
+			   1,
+			   NULL,
+			   param_values,
+			   NULL,
+			   NULL,
+			   0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return NULL;
+	}
+
+	if (PQntuples(res)) {
+		am = (char *)malloc(strlen(PQgetvalue(res, 0, 0)) * sizeof(char) + 1);
+		strcpy(am, PQgetvalue(res, 0, 0));
+	}
+
+	PQclear(res);
+	return am;
+}
+
+
+// check_idx_match(): check the new index has the same
+// definition as the old one, whatever the access method
+int check_idx_match(PGconn *conn, char *iname, char *new_iname)
+{
+	PGresult *res;
+	const char *param_values[2];
+	int ret;
+
+	param_values[0] = iname;
+	param_values[1] = new_iname;
+
+	res = PQexecParams(conn,
+			   CHECK_IDX_MATCH_SQL,
+			   2,
+			   NULL,
+			   param_values,
+			   NULL,
+			   NULL,
+			   0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return FAIL;
+	}
+
+	ret = PQntuples(res) && !strcmp(PQgetvalue(res, 0, 0), "t") ?
+	      SUCCESS : FAIL;
+
+	PQclear(res);
+	return ret;
+}
+
+
+// get_indexdef(): get the definition of
+// the index from pg_indexes
+char *get_indexdef(PGconn *conn, char *iname)
+{
+	PGresult *res;
+	const char *param_values[1];
+	char *idef;
+
+	param_values[0] = iname;
+
+	res = PQexecParams(conn,
+			   GET_IDXDEF_SQL,
+			   1,
+			   NULL,
+			   param_values,
+			   NULL,
+			   NULL,
+			   0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n", PQerrorMessage(conn));
+		PQclear(res);
+		return NULL;
+	}
+
+	if (PQntuples(res)) {
+		idef = (char *)malloc(strlen(PQgetvalue(res, 0, 0)) * sizeof(char) + 1);
+		strcpy(idef, PQgetvalue(res, 0, 0));
+		PQclear(res);
+	} else 
+		idef = NULL;  // No indexdef found
+
+	return idef;
+}
+
+
+// get_idx_comment(): if the comment of index exists, get it,
+// *icomm is NULL if there is no comment
+int get_idx_comment(PGconn *conn, char *iname, char **icomm)
+{
+	PGresult *res;
+	const char *param_values[1];
+
+	param_values[0] = iname;
+	*icomm = NULL;
+
+	res = PQexecParams(conn,
+			   GET_ICOMMENT_SQL,
+			   1,
+			   NULL,
+			   param_values,
+			   NULL,
+			   NULL,
+			   0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return FAIL;
+	}
+
+	// Comment exists:
+	if (PQntuples(res) > 0 && strcmp(PQgetvalue(res, 0, 0), "\0")) {
+		*icomm = (char*)malloc(strlen(PQgetvalue(res, 0, 0)) *
+				       sizeof(char) + 1);
+		strcpy(*icomm, PQgetvalue(res, 0, 0));
+	}
+
+	PQclear(res);
+	return SUCCESS;
+}
+
+
+// choose_fillfactor(): pick the fillfactor of the new btree index
+// leaving room for the entries expected within FF_TARGET_DAYS.
+// The growth rate is taken from the last rebuild of the index in
+// the history file if there is one, or from inserts and non-HOT
+// updates of the table relative to its live tuples otherwise
+int choose_fillfactor(PGconn *conn, struct rebuild_t *rb)
+{
+	PGresult *res;
+	const char *param_values[1];
+	long last_when, last_size;
+	double days, rate = 0, free_frac;
+	char *src;
+	int ff, monotonic = 0;
+
+	if (strcmp(rb->idx_am, "btree")) {
+		log_write(log_fp, INF,
+			  "Keep fillfactor of %s index\n", rb->idx_am);
+		return FAIL;
+	}
+
+	// Inserts of an ever-increasing key (serial, timestamp) go to
+	// the rightmost page, which btree splits without leaving free
+	// space behind, so only updates make room worth reserving:
+	param_values[0] = rb->iname;
+
+	res = PQexecParams(conn, GET_LEAD_CORR_SQL, 1, NULL,
+			   param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) &&
+	    atof(PQgetvalue(res, 0, 0)) >= FF_MONOTONIC) {
+		monotonic = 1;
+		log_write(log_fp, INF, "Leading key is ever-increasing, "
+			  "inserts are not counted\n");
+	}
+	PQclear(res);
+
+	// The re-bloat history counts the growth by inserts as well:
+	if (!monotonic &&
+	    get_last_rebuild(PQdb(conn), rb->iname, &last_when, &last_size) &&
+	    last_size > 0 && time(NULL) - last_when > 3600) {
+		// Re-bloat observed since the last rebuild:
+		days = (time(NULL) - last_when) / 86400.0;
+		rate = ((double)rb->prev_size - last_size) / last_size / days;
+		src = "re-bloat history";
+	} else {
+		res = PQexecParams(conn, GET_TBL_CHURN_SQL, 1, NULL,
+				   param_values, NULL, NULL, 0);
+
+		if (PQresultStatus(res) != PGRES_TUPLES_OK || !PQntuples(res)) {
+			log_write(log_fp, WRN, "No write statistic, keep fillfactor\n");
+			PQclear(res);
+			return FAIL;
+		}
+
+		days = atol(PQgetvalue(res, 0, 4)) / 86400.0;
+		if (days > 0 && atol(PQgetvalue(res, 0, 3)) > 0)
+			rate = ((monotonic ? 0 : atof(PQgetvalue(res, 0, 0))) +
+				atof(PQgetvalue(res, 0, 1)) -
+				atof(PQgetvalue(res, 0, 2))) /
+			       atof(PQgetvalue(res, 0, 3)) / days;
+		src = "table write rate";
+		PQclear(res);
+	}
+
+	if (rate < 0)
+		rate = 0;
+
+	// Room for rate * FF_TARGET_DAYS of new entries per entry:
+	ff = (int)(100 / (1 + rate * FF_TARGET_DAYS));
+	ff = ff / 5 * 5;
+	if (ff < FF_MIN)
+		ff = FF_MIN;
+	if (ff > FF_MAX)
+		ff = FF_MAX;
+
+	rb->fillfactor = ff;
+	free_frac = (100 - ff) / 100.0;
+
+	if (rate > 0) {
+		log_write(log_fp, INF, "Fillfactor %d by %s (%f%% a day), "
+			  "expected re-bloat in %f days\n", ff, src, rate * 100,
+			  free_frac / (1 - free_frac) / rate);
+		print_now_time();
+		printf("%s: fillfactor %d, expected re-bloat in %.1f days\n",
+		       rb->iname, ff, free_frac / (1 - free_frac) / rate);
+	} else {
+		log_write(log_fp, INF, "Fillfactor %d by %s (no growth)\n",
+			  ff, src);
+		print_now_time();
+		printf("%s: fillfactor %d, no growth observed\n",
+		       rb->iname, ff);
+	}
+
+	return SUCCESS;
+}
+
+
+// set_tablespace(): add the TABLESPACE clause to the creation
+// command before the WHERE of a partial index. The passed
+// command is freed, a new one is returned
+char *set_tablespace(PGconn *conn, char *cmd, char *ts)
+{
+	char *new_cmd, *p, *ts_ident;
+	size_t pos;
+
+	ts_ident = PQescapeIdentifier(conn, ts, strlen(ts));
+	if (!ts_ident)
+		return cmd;
+
+	new_cmd = (char*)malloc((strlen(cmd) + strlen(ts_ident) + 13) *
+				sizeof(char));
+
+	p = find_top_where(cmd);
+	pos = p ? (size_t)(p - cmd) : strlen(cmd);
+
+	memcpy(new_cmd, cmd, pos);
+	strcpy(new_cmd + pos, " TABLESPACE ");
+	strcat(new_cmd, ts_ident);
+	strcat(new_cmd, cmd + pos);
+
+	PQfreemem(ts_ident);
+	free(cmd);
+	return new_cmd;
+}
+
+
+// choose_tablespace(): pick the tablespace of the new index.
+// pg_indexes.indexdef has no TABLESPACE, so the current one
+// is kept explicitly. With --ts-hot/--ts-cold, an index read
+// often (by scans or by blocks read from disk) goes to the hot
+// tablespace and a rarely scanned one to the cold tablespace
+// if the target has room for it
+int choose_tablespace(PGconn *conn, struct rebuild_t *rb)
+{
+	PGresult *res;
+	const char *param_values[1];
+	double scans, reads;
+	char *target = NULL;
+	char *heat = NULL;
+	long room;
+
+	param_values[0] = rb->iname;
+
+	res = PQexecParams(conn, GET_IDX_HEAT_SQL, 1, NULL,
+			   param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK || !PQntuples(res)) {
+		log_write(log_fp, WRN, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return FAIL;
+	}
+
+	scans = atof(PQgetvalue(res, 0, 0));
+	reads = atof(PQgetvalue(res, 0, 1));
+
+	if (PQgetvalue(res, 0, 2)[0] != '\0') {
+		rb->tablespace = (char*)malloc(strlen(PQgetvalue(res, 0, 2)) + 1);
+		strcpy(rb->tablespace, PQgetvalue(res, 0, 2));
+	}
+	PQclear(res);
+
+	if (glob_args.ts_hot &&
+	    (scans >= glob_args.hot_scans || reads >= glob_args.hot_reads)) {
+		target = glob_args.ts_hot;
+		heat = "hot";
+	} else if (glob_args.ts_cold && scans <= glob_args.cold_scans) {
+		target = glob_args.ts_cold;
+		heat = "cold";
+	}
+
+	if (!target)
+		return SUCCESS;
+
+	log_write(log_fp, INF, "Index is %s: %f scans/s, %f blocks read/s\n",
+		  heat, scans, reads);
+
+	if (rb->tablespace ? !strcmp(rb->tablespace, target) :
+	    !strcmp(target, "pg_default"))
+		return SUCCESS;
+
+	// Pre-check the target has room for the new index, the
+	// path of the tablespace is on the database host:
+	if (!is_local_conn(conn))
+		log_write(log_fp, WRN, "Not on the database host, free "
+			  "space of tablespace %s is not checked\n", target);
+	else if ((room = get_ts_free(conn, target)) < 0 ||
+		 room < rb->prev_size * TS_RESERVE) {
+		log_write(log_fp, WRN,
+			  "Tablespace %s has no room (%ld bytes free), "
+			  "keep the current one\n", target, room);
+		return SUCCESS;
+	}
+
+	log_write(log_fp, INF, "Move index to tablespace %s\n", target);
+
+	free(rb->tablespace);
+	rb->tablespace = (char*)malloc(strlen(target) + 1);
+	strcpy(rb->tablespace, target);
+
+	return SUCCESS;
+}
+
+
+// is_local_conn(): check the connection goes to the
+// database server of this host (a unix socket or loopback)
+int is_local_conn(PGconn *conn)
+{
+	char *host = PQhost(conn);
+
+	return !host || !*host || host[0] == '/' ||
+	       !strcmp(host, "localhost") || !strcmp(host, "127.0.0.1") ||
+	       !strcmp(host, "::1");
+}
+
+
+// get_ts_free(): free bytes on the file system of the
+// tablespace, -1 if it is unknown. It works when
+// pg_reindex runs on the database host only
+long get_ts_free(PGconn *conn, char *ts)
+{
+	PGresult *res;
+	struct statvfs st;
+	const char *param_values[1];
+	long room = -1;
+
+	param_values[0] = ts;
+
+	res = PQexecParams(conn, GET_TS_PATH_SQL, 1, NULL,
+			   param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) &&
+	    statvfs(PQgetvalue(res, 0, 0), &st) == 0)
+		room = (long)st.f_bavail * st.f_frsize;
+	else if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		log_write(log_fp, WRN, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+	else
+		log_write(log_fp, WRN,
+			  "Can not check free space of tablespace %s\n", ts);
+
+	PQclear(res);
+	return room;
+}
+
+
+// get_last_rebuild(): find the time and the size after
+// the last rebuild of the index in the history file.
+// Lines are "DBNAME IDXNAME EPOCH SIZE FILLFACTOR"
+int get_last_rebuild(char *db_name, char *iname, long *when, long *size)
+{
+	FILE *fp;
+	char db[68], idx[68];
+	long t, sz;
+	int ff, found = 0;
+
+	if ((fp = fopen(glob_args.history, "r")) == NULL)
+		return FAIL;
+
+	while (fscanf(fp, "%67s %67s %ld %ld %d", db, idx, &t, &sz, &ff) == 5) {
+		// Build marks of new_ indexes:
+		if (sz < 0)
+			continue;
+
+		if (!strcmp(db, db_name) && !strcmp(idx, iname)) {
+			*when = t;
+			*size = sz;
+			found = 1;
+		}
+	}
+
+	fclose(fp);
+	return found ? SUCCESS : FAIL;
+}
+
+
+// save_rebuild(): append the rebuild to the history file
+void save_rebuild(char *db_name, struct rebuild_t *rb, long size)
+{
+	FILE *fp;
+
+	if ((fp = fopen(glob_args.history, "a")) == NULL) {
+		log_write(log_fp, WRN, "Could not open the history file %s\n",
+			  glob_args.history);
+		return;
+	}
+
+	fprintf(fp, "%s %s %ld %ld %d\n", db_name, rb->iname,
+		(long)time(NULL), size, rb->fillfactor);
+	fclose(fp);
+}
+
+
+// mark_build(): record in the history file that the new_ index
+// is being built by pg_reindex (BUILD_STARTED) or is gone
+// (BUILD_ENDED), --reconcile renames and swaps only the new_
+// indexes marked as started
+void mark_build(char *db_name, char *new_iname, long state)
+{
+	FILE *fp;
+
+	if ((fp = fopen(glob_args.history, "a")) == NULL) {
+		log_write(log_fp, WRN, "Could not open the history file %s\n",
+			  glob_args.history);
+		return;
+	}
+
+	fprintf(fp, "%s %s %ld %ld 0\n", db_name, new_iname,
+		(long)time(NULL), state);
+	fclose(fp);
+}
+
+
+// check_build_mark(): is the last mark of the new_ index
+// in the history file BUILD_STARTED
+int check_build_mark(char *db_name, char *new_iname)
+{
+	FILE *fp;
+	char db[68], idx[68];
+	long t, sz;
+	int ff, started = 0;
+
+	if ((fp = fopen(glob_args.history, "r")) == NULL)
+		return FAIL;
+
+	while (fscanf(fp, "%67s %67s %ld %ld %d", db, idx, &t, &sz, &ff) == 5)
+		if (sz < 0 && !strcmp(db, db_name) && !strcmp(idx, new_iname))
+			started = sz == BUILD_STARTED;
+
+	fclose(fp);
+	return started ? SUCCESS : FAIL;
+}
+
+
+// create_idx(): create index. While CREATE INDEX CONCURRENTLY
+// runs, the monitoring connection checks if it waits for old
+// snapshots; the time of waiting is returned in wait_ms
+int create_idx(PGconn *conn, char *cmd, double *wait_ms)
+{
+	PGresult *res;
+	PGconn *mon;
+	fd_set fds;
+	struct timeval tv;
+	const char *param_values[2];
+	char pid_buf[16], own_pids[64], wait_ev[64] = "";
+	double sample_ms = 0, wait_start = 0;
+	int sock = PQsocket(conn);
+	int waiting = 0;
+	int ret = 1;
+	int poll_ms = XACT_POLL_MS;
+	int i;
+	double last, now;
+
+	log_write(log_fp, INF, "%s\n", cmd);
+
+	*wait_ms = 0;
+
+	if ((mon = get_mon_conn(conn)) == NULL) {
+		res = PQexec(conn, cmd);
+		if (PQresultStatus(res) == PGRES_COMMAND_OK) {
+			PQclear(res);
+			return 1;
+		} else {
+			log_write(log_fp, ERR, "QUERY failed: %s\n",
+				  PQerrorMessage(conn));
+			PQclear(res);
+			return 0;
+		}
+	}
+
+	if (!PQsendQuery(conn, cmd)) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		return 0;
+	}
+
+	snprintf(pid_buf, sizeof(pid_buf), "%d", PQbackendPID(conn));
+	get_own_pids(conn, own_pids, sizeof(own_pids));
+	param_values[0] = pid_buf;
+	param_values[1] = own_pids;
+	last = now_ms();
+
+	// Wake up often enough to sample wait events:
+	if (trace_enabled() && TRACE_SAMPLE_MS < poll_ms)
+		poll_ms = TRACE_SAMPLE_MS;
+
+	while (PQisBusy(conn)) {
+		FD_ZERO(&fds);
+		FD_SET(sock, &fds);
+		tv.tv_sec = poll_ms / 1000;
+		tv.tv_usec = (poll_ms % 1000) * 1000;
+
+		if (select(sock + 1, &fds, NULL, NULL, &tv) < 0)
+			break;
+
+		if (!PQconsumeInput(conn) || !PQisBusy(conn))
+			break;
+
+		if (trace_enabled())
+			trace_wait_event(mon, pid_buf, wait_ev, sizeof(wait_ev),
+					 &sample_ms);
+
+		// Old snapshots are still checked every XACT_POLL_MS:
+		now = now_ms();
+		if (now - last < XACT_POLL_MS)
+			continue;
+
+		// Count the interval if the build was waiting at its start:
+		if (waiting)
+			*wait_ms += now - last;
+		last = now;
+
+		res = PQexecParams(mon, GET_SNAP_WAIT_SQL, 2, NULL,
+				   param_values, NULL, NULL, 0);
+
+		if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+			PQclear(res);
+			waiting = 0;
+			continue;
+		}
+
+		for (i = 0; i < PQntuples(res); i++) {
+			if (glob_args.xact_policy == XACT_TERMINATE &&
+			    !strncmp(PQgetvalue(res, i, 1), "idle in transaction", 19) &&
+			    atoi(PQgetvalue(res, i, 2)) >= glob_args.xact_max_age)
+				terminate_backend(mon, PQgetvalue(res, i, 0));
+			else if (!waiting)
+				log_write(log_fp, WRN,
+					  "Build waits for pid %s (%s) "
+					  "in transaction for %s sec\n",
+					  PQgetvalue(res, i, 0),
+					  PQgetvalue(res, i, 1),
+					  PQgetvalue(res, i, 2));
+		}
+
+		// Show the wait for old snapshots as a span:
+		if (!waiting && PQntuples(res))
+			wait_start = now;
+		else if (waiting && !PQntuples(res))
+			trace_complete(TRK_MAIN, "snapshot wait", "wait",
+				       wait_start, now - wait_start, NULL, NULL);
+
+		waiting = PQntuples(res) > 0;
+		PQclear(res);
+	}
+
+	if (waiting)
+		trace_complete(TRK_MAIN, "snapshot wait", "wait", wait_start,
+			       now_ms() - wait_start, NULL, NULL);
+
+	while ((res = PQgetResult(conn)) != NULL) {
+		if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+			log_write(log_fp, ERR, "QUERY failed: %s\n",
+				  PQerrorMessage(conn));
+			ret = 0;
+		}
+		PQclear(res);
+	}
+
+	return ret;
+}
+
+
+// wait_old_xacts(): the pre-flight check of transactions
+// older than --xact-max-age. CREATE INDEX CONCURRENTLY waits
+// for all of them, so warn about them, terminate the idle
+// ones or defer the build up to --defer-max seconds
+int wait_old_xacts(PGconn *conn)
+{
+	double start = now_ms();
+	int left;
+
+	left = check_old_xacts(conn,
+			       glob_args.xact_policy == XACT_TERMINATE, 1);
+
+	if (!left || glob_args.xact_policy != XACT_DEFER)
+		return SUCCESS;
+
+	log_write(log_fp, WRN,
+		  "Defer the build until %d transaction(s) finish\n", left);
+
+	while (left) {
+		if (now_ms() - start > glob_args.defer_max * 1000.0) {
+			log_write(log_fp, ERR,
+				  "Transactions are running after %d sec\n",
+				  glob_args.defer_max);
+			return FAIL;
+		}
+
+		sleep_ms(XACT_POLL_MS);
+		left = check_old_xacts(conn, 0, 0);
+	}
+
+	log_write(log_fp, INF, "Build deferred for %f ms\n",
+		  now_ms() - start);
+
+	return SUCCESS;
+}
+
+
+// check_old_xacts(): count transactions older than --xact-max-age
+// in the database, except the sessions of pg_reindex. With terminate
+// the ones idle in transaction are terminated and not counted
+int check_old_xacts(PGconn *conn, int terminate, int verbose)
+{
+	PGresult *res;
+	const char *param_values[2];
+	char age_buf[16], pid_buf[64];
+	int i, left = 0;
+
+	snprintf(age_buf, sizeof(age_buf), "%d", glob_args.xact_max_age);
+	get_own_pids(conn, pid_buf, sizeof(pid_buf));
+
+	param_values[0] = age_buf;
+	param_values[1] = pid_buf;
+
+	res = PQexecParams(conn, PQserverVersion(conn) >= 100000 ?
+			   GET_OLD_XACTS_SQL : GET_OLD_XACTS_96_SQL, 2, NULL,
+			   param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		log_write(log_fp, WRN, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return 0;
+	}
+
+	for (i = 0; i < PQntuples(res); i++) {
+		if (terminate &&
+		    !strncmp(PQgetvalue(res, i, 2), "idle in transaction", 19) &&
+		    terminate_backend(conn, PQgetvalue(res, i, 0)))
+			continue;
+
+		if (verbose)
+			log_write(log_fp, WRN,
+				  "Old transaction: pid %s, user %s, %s "
+				  "for %s sec: %s\n", PQgetvalue(res, i, 0),
+				  PQgetvalue(res, i, 1), PQgetvalue(res, i, 2),
+				  PQgetvalue(res, i, 3), PQgetvalue(res, i, 4));
+		left++;
+	}
+
+	PQclear(res);
+	return left;
+}
+
+
+// terminate_backend(): terminate the session with the pid
+int terminate_backend(PGconn *conn, char *pid)
+{
+	PGresult *res;
+	const char *param_values[1];
+	int ret;
+
+	param_values[0] = pid;
+
+	res = PQexecParams(conn, TERMINATE_SQL, 1, NULL,
+			   param_values, NULL, NULL, 0);
+
+	ret = PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) &&
+	      !strcmp(PQgetvalue(res, 0, 0), "t") ? SUCCESS : FAIL;
+
+	if (ret == SUCCESS)
+		log_write(log_fp, WRN,
+			  "Terminated pid %s idle in transaction\n", pid);
+	else
+		log_write(log_fp, ERR, "Can not terminate pid %s: %s\n",
+			  pid, PQerrorMessage(conn));
+
+	PQclear(res);
+	return ret;
+}
+
+
+// get_idx_table(): get the table name of the index
+char *get_idx_table(PGconn *conn, char *iname)
+{
+	PGresult *res;
+	const char *param_values[1];
+	char *tbl_name = NULL;
+
+	param_values[0] = iname;
+
+	res = PQexecParams(conn, GET_IDX_TBL_SQL, 1, NULL,
+			   param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return NULL;
+	}
+
+	if (PQntuples(res)) {
+		tbl_name = (char*)malloc(strlen(PQgetvalue(res, 0, 0)) + 1);
+		strcpy(tbl_name, PQgetvalue(res, 0, 0));
+	}
+
+	PQclear(res);
+	return tbl_name;
+}
+
+
+// wait_vacuum(): defer the build while a vacuum processes
+// the table, up to --defer-max seconds. CREATE INDEX
+// CONCURRENTLY conflicts with it: autovacuum would be
+// cancelled losing its work, a manual or anti-wraparound
+// vacuum would keep the build waiting. Returns FAIL if
+// the vacuum is still running
+int wait_vacuum(PGconn *conn, char *tbl_name)
+{
+	PGresult *res;
+	const char *param_values[1];
+	double start = now_ms();
+	int polls = 0;
+
+	param_values[0] = tbl_name;
+
+	while (1) {
+		res = PQexecParams(conn, GET_TBL_VACUUM_SQL, 1, NULL,
+				   param_values, NULL, NULL, 0);
+
+		if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+			log_write(log_fp, WRN, "QUERY failed: %s\n",
+				  PQerrorMessage(conn));
+			PQclear(res);
+			return SUCCESS;
+		}
+
+		if (!PQntuples(res)) {
+			PQclear(res);
+			break;
+		}
+
+		if (!polls)
+			log_write(log_fp, WRN,
+				  "%s pid %s is in phase %s on %s, defer the build\n",
+				  PQgetvalue(res, 0, 2)[0] == 't' ?
+				  "Autovacuum" : "Vacuum", PQgetvalue(res, 0, 0),
+				  PQgetvalue(res, 0, 1), tbl_name);
+		PQclear(res);
+
+		if (now_ms() - start > glob_args.defer_max * 1000.0) {
+			log_write(log_fp, WRN,
+				  "Vacuum is running after %d sec\n",
+				  glob_args.defer_max);
+			return FAIL;
+		}
+
+		sleep_ms(XACT_POLL_MS);
+		polls++;
+	}
+
+	if (polls)
+		log_write(log_fp, INF, "Build deferred for vacuum %f ms\n",
+			  now_ms() - start);
+
+	return SUCCESS;
+}
+
+
+// add_batch_table(): remember the rebuilt table once
+void add_batch_table(struct batch_stat_t *bs, char *tbl_name)
+{
+	int i;
+
+	for (i = 0; i < bs->n_tables; i++)
+		if (!strcmp(bs->tables[i], tbl_name))
+			return;
+
+	bs->tables = (char**)realloc(bs->tables,
+				     (bs->n_tables + 1) * sizeof(char*));
+	bs->tables[bs->n_tables] = (char*)malloc(strlen(tbl_name) + 1);
+	strcpy(bs->tables[bs->n_tables], tbl_name);
+	bs->n_tables++;
+}
+
+
+// post_vacuum(): refresh statistics of the rebuilt table for
+// the next bloat estimate: VACUUM ANALYZE if dead tuples are
+// more than --vacuum-dead percent, otherwise ANALYZE
+int post_vacuum(PGconn *conn, char *tbl_name)
+{
+	PGresult *res;
+	const char *param_values[1];
+	double dead = 0;
+	char *cmd;
+	int ret;
+
+	param_values[0] = tbl_name;
+
+	res = PQexecParams(conn, GET_DEAD_RATIO_SQL, 1, NULL,
+			   param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res))
+		dead = atof(PQgetvalue(res, 0, 0));
+	PQclear(res);
+
+	// 16 is a length of "VACUUM ANALYZE " + 1 '\0'
+	cmd = (char*)malloc((16 + strlen(tbl_name)) * sizeof(char));
+
+	strcpy(cmd, dead > glob_args.vacuum_dead ? "VACUUM ANALYZE " : "ANALYZE ");
+	strcat(cmd, tbl_name);
+
+	log_write(log_fp, INF, "Dead tuples %f%%: %s\n", dead, cmd);
+
+	res = PQexec(conn, cmd);
+
+	if (PQresultStatus(res) == PGRES_COMMAND_OK)
+		ret = SUCCESS;
+	else {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		ret = FAIL;
+	}
+
+	PQclear(res);
+	free(cmd);
+	return ret;
+}
+
+
+// trace_wait_event(): sample the wait event of the backend
+// on the monitoring connection at most every TRACE_SAMPLE_MS
+// and put it to the trace when it changes
+void trace_wait_event(PGconn *mon, const char *pid, char *last,
+		      size_t len, double *last_ms)
+{
+	PGresult *res;
+	const char *param_values[1];
+	double now = now_ms();
+
+	if (now - *last_ms < TRACE_SAMPLE_MS)
+		return;
+
+	*last_ms = now;
+	param_values[0] = pid;
+
+	res = PQexecParams(mon, GET_WAIT_EVENT_SQL, 1, NULL,
+			   param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) &&
+	    strcmp(PQgetvalue(res, 0, 0), last)) {
+		snprintf(last, len, "%s", PQgetvalue(res, 0, 0));
+		trace_instant(TRK_MAIN, last, "wait", now, "pid", pid);
+	}
+
+	PQclear(res);
+}
+
+
+// get_own_pids(): the array literal of backend pids
+// of pg_reindex connections
+void get_own_pids(PGconn *conn, char *buf, size_t len)
+{
+	struct dmn_pool_t *pool = dmn_conn_pool(conn);
+	PGconn *mon = pool ? pool->mon : mon_conn;
+
+	snprintf(buf, len, "{%d,%d,%d}", PQbackendPID(conn),
+		 mon ? PQbackendPID(mon) : 0,
+		 ver_conn ? PQbackendPID(ver_conn) : 0);
+}
+
+
+// add_comment(): add comment for index
+int add_comment(PGconn *conn, char *iname, char *comment)
+{
+	PGresult *res;
+	char *str = "COMMENT ON INDEX ";
+	char *add_comment_sql;
+
+	add_comment_sql = malloc((strlen(str) + 7 +
+				  strlen(comment) + strlen(iname)) *
+				  sizeof(char));
+
+	strcpy(add_comment_sql, str);
+	strcat(add_comment_sql, iname);
+	strcat(add_comment_sql, " IS '");
+	strcat(add_comment_sql, comment);
+	strcat(add_comment_sql, "'");
+
+	res = PQexec(conn, add_comment_sql);
+	free(add_comment_sql);
+
+	if (PQresultStatus(res) == PGRES_COMMAND_OK) {
+		PQclear(res);
+		return 1;
+	} else {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return 0;
+	}
+}
+
+
+// prewarm_idx(): load the index into shared buffers
+// with pg_prewarm. If the index is larger than the budget
+// (in bytes, 0 is unlimited), load the inner btree pages
+// and the rightmost leaf pages that fit into the budget:
+// a freshly built btree keeps leaves in key order, so the
+// tail holds the most recent keys
+int prewarm_idx(PGconn *conn, char *iname, long budget)
+{
+	PGresult *res;
+	const char *param_values[3];
+	char nblocks_str[24], first_str[24], last_str[24];
+	long nblocks, bsize, limit, loaded = 0;
+	double start;
+	int is_btree;
+
+	if (!check_extension(conn, "pg_prewarm")) {
+		log_write(log_fp, WRN, "Extension pg_prewarm not found\n");
+		return FAIL;
+	}
+
+	param_values[0] = iname;
+
+	res = PQexecParams(conn, GET_IDX_BLOCKS_SQL, 1, NULL,
+			   param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK || !PQntuples(res)) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return FAIL;
+	}
+
+	nblocks = atol(PQgetvalue(res, 0, 0));
+	bsize = atol(PQgetvalue(res, 0, 1));
+	is_btree = !strcmp(PQgetvalue(res, 0, 2), "btree");
+	PQclear(res);
+
+	limit = budget > 0 ? budget / bsize : nblocks;
+	start = now_ms();
+
+	if (limit >= nblocks) {
+		res = PQexecParams(conn, PREWARM_IDX_SQL, 1, NULL,
+				   param_values, NULL, NULL, 0);
+
+		if (PQresultStatus(res) == PGRES_TUPLES_OK)
+			loaded = atol(PQgetvalue(res, 0, 0));
+		else
+			log_write(log_fp, ERR, "QUERY failed: %s\n",
+				  PQerrorMessage(conn));
+		PQclear(res);
+	} else {
+		snprintf(nblocks_str, sizeof(nblocks_str), "%ld", nblocks);
+		param_values[1] = nblocks_str;
+
+		// Upper levels first, they are needed by every scan:
+		if (is_btree && check_extension(conn, "pageinspect")) {
+			snprintf(last_str, sizeof(last_str), "%ld", limit);
+			param_values[2] = last_str;
+
+			res = PQexecParams(conn, PREWARM_BT_UPPER_SQL, 3, NULL,
+					   param_values, NULL, NULL, 0);
+
+			if (PQresultStatus(res) == PGRES_TUPLES_OK)
+				loaded = atol(PQgetvalue(res, 0, 0));
+			else
+				log_write(log_fp, WRN, "QUERY failed: %s\n",
+					  PQerrorMessage(conn));
+			PQclear(res);
+		}
+
+		if (limit > loaded) {
+			snprintf(first_str, sizeof(first_str), "%ld",
+				 nblocks - (limit - loaded));
+			snprintf(last_str, sizeof(last_str), "%ld", nblocks - 1);
+			param_values[1] = first_str;
+			param_values[2] = last_str;
+
+			res = PQexecParams(conn, PREWARM_RANGE_SQL, 3, NULL,
+					   param_values, NULL, NULL, 0);
+
+			if (PQresultStatus(res) == PGRES_TUPLES_OK)
+				loaded += atol(PQgetvalue(res, 0, 0));
+			else
+				log_write(log_fp, ERR, "QUERY failed: %s\n",
+					  PQerrorMessage(conn));
+			PQclear(res);
+		}
+	}
+
+	log_write(log_fp, INF,
+		  "Prewarmed %ld of %ld blocks (%ld bytes) in %f ms\n",
+		  loaded, nblocks, loaded * bsize, now_ms() - start);
+
+	return loaded > 0 ? SUCCESS : FAIL;
+}
+
+
+// drop_idx(): drop an index
+int drop_idx(PGconn *conn, char *iname)
+{
+	int ret;
+	char *drop_cmd;
+
+	// 24 is a length of "DROP INDEX CONCURRENTLY + 1 '\0'"
+	drop_cmd = (char*)malloc((25 + strlen(iname)) * sizeof(char));
+
+	strcpy(drop_cmd, "DROP INDEX CONCURRENTLY ");
+	strcat(drop_cmd, iname);
+
+	log_write(log_fp, INF, "%s\n", drop_cmd);
+
+	ret = exec_swap_cmd(conn, drop_cmd);
+	free(drop_cmd);
+
+	return ret;
+}
+
+
+// rename_idx(): rename an index
+int rename_idx(PGconn *conn, char *tmp_iname, char *iname)
+{
+	int ret;
+	char *rename_cmd;
+
+	// 23 is a length of "ALTER INDEX RENAME TO " + 1 '\0'
+	rename_cmd = (char*)malloc((24 + strlen(tmp_iname) + strlen(iname))
+		                       * sizeof(char));
+
+	strcpy(rename_cmd, "ALTER INDEX ");
+	strcat(rename_cmd, tmp_iname);
+	strcat(rename_cmd, " RENAME TO ");
+	strcat(rename_cmd, iname);
+
+	log_write(log_fp, INF, "%s\n", rename_cmd);
+
+	ret = exec_swap_cmd(conn, rename_cmd);
+	free(rename_cmd);
+
+	return ret;
+}
+
+
+// exec_swap_cmd(): execute a command of the index swap;
+// if the watchdog cancels it, wait and try again
+int exec_swap_cmd(PGconn *conn, char *cmd)
+{
+	PGresult *res;
+	int ret;
+	int attempt;
+	int delay = WD_RETRY_DELAY_MS;
+	double start = now_ms();
+
+	if (!glob_args.watchdog) {
+		res = PQexec(conn, cmd);
+		ret = PQresultStatus(res) == PGRES_COMMAND_OK ? SUCCESS : FAIL;
+
+		if (ret == FAIL)
+			log_write(log_fp, ERR, "QUERY failed: %s\n",
+				  PQerrorMessage(conn));
+		PQclear(res);
+
+		trace_complete(TRK_MAIN, "swap command", "swap", start,
+			       now_ms() - start, "query", cmd);
+		return ret;
+	}
+
+	ret = exec_watched(conn, cmd);
+	trace_complete(TRK_MAIN, "swap command", "swap", start,
+		       now_ms() - start, "query", cmd);
+
+	for (attempt = 1; ret == CANCELED &&
+	     attempt <= glob_args.swap_retries; attempt++) {
+		log_write(log_fp, WRN,
+			  "Retry %d of %d in %d ms\n",
+			  attempt, glob_args.swap_retries, delay);
+		sleep_ms(delay);
+		delay *= 2;
+
+		start = now_ms();
+		ret = exec_watched(conn, cmd);
+		trace_complete(TRK_MAIN, "swap retry", "swap", start,
+			       now_ms() - start, "query", cmd);
+	}
+
+	if (ret == CANCELED) {
+		log_write(log_fp, ERR, "All retries have been cancelled\n");
+		return FAIL;
+	}
+
+	return ret;
+}
+
+
+// exec_watched(): send a command and poll the lock queue
+// on the monitoring connection until the command is done.
+// If the command blocks too many sessions or blocks them
+// for too long, cancel it and return CANCELED
+int exec_watched(PGconn *conn, char *cmd)
+{
+	PGresult *res;
+	PGcancel *cancel;
+	PGconn *mon;
+	fd_set fds;
+	struct timeval tv;
+	char errbuf[256] = "";
+	char pid_buf[16], wait_ev[64] = "", info[64];
+	double sample_ms = 0;
+	int sock = PQsocket(conn);
+	int pid = PQbackendPID(conn);
+	int blocked = 0;
+	int block_ms = 0;
+	int canceled = 0;
+	int ret = SUCCESS;
+	struct wd_pid_t seen[WD_MAX_PIDS];
+	int n_seen = 0;
+
+	if ((mon = get_mon_conn(conn)) == NULL) {
+		log_write(log_fp, WRN,
+			  "Watchdog is unavailable, run without it\n");
+		res = PQexec(conn, cmd);
+		ret = PQresultStatus(res) == PGRES_COMMAND_OK ? SUCCESS : FAIL;
+		if (ret == FAIL)
+			log_write(log_fp, ERR, "QUERY failed: %s\n",
+				  PQerrorMessage(conn));
+		PQclear(res);
+		return ret;
+	}
+
+	if (!PQsendQuery(conn, cmd)) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		return FAIL;
+	}
+
+	snprintf(pid_buf, sizeof(pid_buf), "%d", pid);
+
+	while (PQisBusy(conn)) {
+		FD_ZERO(&fds);
+		FD_SET(sock, &fds);
+		tv.tv_sec = 0;
+		tv.tv_usec = WD_INTERVAL_MS * 1000;
+
+		if (select(sock + 1, &fds, NULL, NULL, &tv) < 0)
+			break;
+
+		if (!PQconsumeInput(conn))
+			break;
+
+		if (canceled || !PQisBusy(conn))
+			continue;
+
+		if (trace_enabled())
+			trace_wait_event(mon, pid_buf, wait_ev, sizeof(wait_ev),
+					 &sample_ms);
+
+		if (!check_lock_queue(mon, pid, &blocked, &block_ms,
+				      seen, &n_seen))
+			continue;
+
+		if (blocked > glob_args.max_blocked ||
+		    (blocked > 0 && block_ms > glob_args.max_block_ms)) {
+			log_write(log_fp, WRN,
+				  "Watchdog: %d session(s) blocked for %d ms, "
+				  "cancel the statement\n", blocked, block_ms);
+
+			snprintf(info, sizeof(info), "%d session(s), %d ms",
+				 blocked, block_ms);
+			trace_instant(TRK_MON, "watchdog cancel", "watchdog",
+				      now_ms(), "blocked", info);
+
+			cancel = PQgetCancel(conn);
+			if (cancel && PQcancel(cancel, errbuf, sizeof(errbuf)))
+				canceled = 1;
+			else
+				log_write(log_fp, ERR,
+					  "Can not cancel: %s\n", errbuf);
+			PQfreeCancel(cancel);
+		}
+	}
+
+	while ((res = PQgetResult(conn)) != NULL) {
+		if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+			if (!canceled)
+				log_write(log_fp, ERR, "QUERY failed: %s\n",
+					  PQerrorMessage(conn));
+			ret = FAIL;
+		}
+		PQclear(res);
+	}
+
+	// The command may have completed before the cancel arrived:
+	if (canceled && ret == FAIL)
+		return CANCELED;
+
+	return ret;
+}
+
+
+// check_lock_queue(): count sessions waiting for
+// locks held or requested by the backend with the pid
+// and the longest time one of them has been waiting.
+// Before PG 14 there is no pg_locks.waitstart, the wait
+// is counted from the poll that saw the session first
+int check_lock_queue(PGconn *conn, int pid, int *blocked, int *block_ms,
+		     struct wd_pid_t *seen, int *n_seen)
+{
+	PGresult *res;
+	const char *param_values[1];
+	char pid_str[16];
+	struct wd_pid_t cur[WD_MAX_PIDS];
+	double now, first;
+	int n_cur = 0;
+	int i, j;
+
+	snprintf(pid_str, sizeof(pid_str), "%d", pid);
+	param_values[0] = pid_str;
+
+	if (PQserverVersion(conn) < 140000) {
+		res = PQexecParams(conn, LOCK_QUEUE_PIDS_SQL, 1, NULL,
+				   param_values, NULL, NULL, 0);
+
+		if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+			log_write(log_fp, WRN, "QUERY failed: %s\n",
+				  PQerrorMessage(conn));
+			PQclear(res);
+			return FAIL;
+		}
+
+		now = now_ms();
+		first = now;
+
+		// Keep the sessions that are still queued:
+		for (i = 0; i < PQntuples(res) && n_cur < WD_MAX_PIDS; i++) {
+			cur[n_cur].pid = atoi(PQgetvalue(res, i, 0));
+			cur[n_cur].since = now;
+
+			for (j = 0; j < *n_seen; j++)
+				if (seen[j].pid == cur[n_cur].pid)
+					cur[n_cur].since = seen[j].since;
+
+			if (cur[n_cur].since < first)
+				first = cur[n_cur].since;
+			n_cur++;
+		}
+
+		*blocked = PQntuples(res);
+		*block_ms = (int)(now - first);
+
+		memcpy(seen, cur, n_cur * sizeof(struct wd_pid_t));
+		*n_seen = n_cur;
+
+		PQclear(res);
+		return SUCCESS;
+	}
+
+	res = PQexecParams(conn,
+			   LOCK_QUEUE_SQL,
+			   1,
+			   NULL,
+			   param_values,
+			   NULL,
+			   NULL,
+			   0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		log_write(log_fp, WRN, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return FAIL;
+	}
+
+	*blocked = atoi(PQgetvalue(res, 0, 0));
+	*block_ms = atoi(PQgetvalue(res, 0, 1));
+
+	PQclear(res);
+	return SUCCESS;
+}
+
+
+// get_mon_conn(): open the monitoring connection to the
+// database of the main connection on the first call and
+// return it, the daemon keeps one per pooled database
+PGconn *get_mon_conn(PGconn *conn)
+{
+	struct dmn_pool_t *pool;
+
+	if ((pool = dmn_conn_pool(conn)) != NULL)
+		return get_extra_conn(&pool->mon, pool->conninfo);
+
+	return get_extra_conn(&mon_conn, db_conninfo);
+}
+
+
+// get_ver_conn(): open the connection for verification
+// of new indexes on the first call and return it
+PGconn *get_ver_conn(void)
+{
+	return get_extra_conn(&ver_conn, db_conninfo);
+}
+
+
+// get_extra_conn(): (re)connect the additional connection
+// with conninfo if it is not connected
+PGconn *get_extra_conn(PGconn **conn, char *conninfo)
+{
+	if (*conn && PQstatus(*conn) == CONNECTION_OK)
+		return *conn;
+
+	if (*conn)
+		PQfinish(*conn);
+
+	*conn = PQconnectdb(conninfo);
+
+	if (PQstatus(*conn) != CONNECTION_OK) {
+		log_write(log_fp, ERR, "Additional connection failed: %s\n",
+			  PQerrorMessage(*conn));
+		PQfinish(*conn);
+		*conn = NULL;
+	}
+
+	return *conn;
+}
+
+
+// rebuild_idx(): the main function for rebuilding
+int rebuild_idx(PGconn *conn, char *iname)
+{
+	struct rebuild_t rb;
+	struct io_obs_t *obs = NULL;
+	char *tbl_name = NULL;
+	int n_obs = 0;
+	int ret;
+
+	init_rebuild(&rb, iname);
+
+	ret = build_new_idx(conn, &rb);
+
+	// Verify the new index on the main connection:
+	if (ret == SUCCESS && glob_args.verify) {
+		if (send_verify(conn, &rb))
+			ret = wait_verify(conn, &rb);
+		else
+			ret = FAIL;
+	}
+
+	if (ret == SUCCESS)
+		ret = swap_new_idx(conn, &rb);
+	else if (rb.skipped) {
+		log_write(log_fp, INF, "== Rebuilding skipped ==\n");
+		ret = SUCCESS;
+	} else
+		log_write(log_fp, ERR, "== Rebuilding failed ==\n");
+
+	if (glob_args.post_analyze && rb.done)
+		tbl_name = strdup(rb.tbl_name);
+
+	if (glob_args.observe > 0 && rb.done)
+		add_io_obs(&obs, &n_obs, &rb);
+
+	finish_rebuild(&rb, NULL);
+
+	report_io_obs(conn, obs, n_obs);
+	free(obs);
+
+	// Statistics are refreshed after the observation window,
+	// so reads of ANALYZE are not counted to the new index:
+	if (tbl_name) {
+		post_vacuum(conn, tbl_name);
+		free(tbl_name);
+	}
+
+	return ret;
+}
+
+
+// rebuild_from_file(): rebuild indexes named in the file
+// one by one. With --verify the new index is checked on
+// a separate connection while the next one is being built,
+// and is swapped when both are done
+int rebuild_from_file(PGconn *conn, char *filename)
+{
+	FILE *file = NULL;
+	PGconn *vconn = NULL;
+	struct rebuild_t *rb = NULL;
+	struct rebuild_t *pending = NULL;
+	struct batch_stat_t bs = {0};
+	char buf[68];
+	char *str = NULL;
+	int ret, i;
+
+	file = fopen(filename, "r");
+
+	if (!file) {
+		fprintf(stderr,
+			"Could not open the file %s\n", filename);
+		log_write(log_fp, ERR,
+		          "Could not open the file %s\n", filename);
+		exit_nicely(conn);
+	}
+
+	if (glob_args.verify && (vconn = get_ver_conn()) == NULL) {
+		log_write(log_fp, WRN,
+			  "Verify on the main connection, no pipelining\n");
+		vconn = conn;
+	}
+
+	while (1) {
+		str = fgets(buf, sizeof(buf), file);
+
+		if (str == NULL) {
+			if (feof(file) != 0) {
+				break;
+			} else {
+				fprintf(stderr,
+                                        "Error of reading file, exit\n");
+				log_write(log_fp, ERR,
+                                          "Error of reading file\n");
+				exit_nicely(conn);
+			}
+		}
+
+		if (!parse_idx_line(str))
+			continue;
+
+		// For each indexname in the file, do:
+		rb = (struct rebuild_t*)malloc(sizeof(struct rebuild_t));
+		init_rebuild(rb, str);
+
+		ret = build_new_idx(conn, rb);
+
+		// The previous index has been verified meanwhile:
+		if (pending) {
+			finish_verified(conn, vconn, pending, &bs);
+			pending = NULL;
+		}
+
+		if (ret != SUCCESS) {
+			if (rb->skipped)
+				log_write(log_fp, INF, "== Rebuilding skipped ==\n");
+			else
+				log_write(log_fp, ERR, "== Rebuilding failed ==\n");
+			finish_rebuild(rb, &bs);
+			free(rb);
+			continue;
+		}
+
+		if (!glob_args.verify) {
+			swap_new_idx(conn, rb);
+			finish_rebuild(rb, &bs);
+			free(rb);
+		} else if (vconn != conn && send_verify(vconn, rb)) {
+			pending = rb;
+		} else {
+			finish_verified(conn, vconn, rb, &bs);
+		}
+	}
+
+	if (pending)
+		finish_verified(conn, vconn, pending, &bs);
+
+	fclose(file);
+
+	log_batch_summary(&bs);
+
+	report_io_obs(conn, bs.obs, bs.n_obs);
+	free(bs.obs);
+
+	// Refresh statistics of the rebuilt tables after the
+	// observation window:
+	for (i = 0; i < bs.n_tables; i++) {
+		post_vacuum(conn, bs.tables[i]);
+		free(bs.tables[i]);
+	}
+	free(bs.tables);
+
+	return SUCCESS;
+}
+
+
+// finish_verified(): wait for the verification of the new
+// index, swap it and release the rebuild state
+void finish_verified(PGconn *conn, PGconn *vconn, struct rebuild_t *rb,
+		     struct batch_stat_t *bs)
+{
+	int ret;
+
+	// Nothing in flight when verifying on the main connection:
+	if (vconn == conn)
+		ret = send_verify(vconn, rb) ? wait_verify(vconn, rb) : FAIL;
+	else
+		ret = wait_verify(vconn, rb);
+
+	if (ret == SUCCESS)
+		swap_new_idx(conn, rb);
+	else
+		log_write(log_fp, ERR, "== Rebuilding failed ==: %s\n",
+			  rb->iname);
+
+	finish_rebuild(rb, bs);
+	free(rb);
+}
+
+
+// init_rebuild(): prepare the state of the index rebuild
+void init_rebuild(struct rebuild_t *rb, char *iname)
+{
+	int i;
+
+	memset(rb, 0, sizeof(struct rebuild_t));
+	snprintf(rb->iname, sizeof(rb->iname), "%s", iname);
+	rb->pred_gain = -1;
+
+	for (i = 0; i < PH_COUNT; i++) {
+		rb->phase_ms[i] = -1;
+		rb->wal_start[i] = -1;
+		rb->wal_bytes[i] = -1;
+	}
+}
+
+
+// free_rebuild(): free the rebuild state
+void free_rebuild(struct rebuild_t *rb)
+{
+	free(rb->indexdef);
+	free(rb->idx_comment);
+	free(rb->idx_am);
+	free(rb->new_iname);
+	free(rb->tablespace);
+	free(rb->tbl_name);
+
+	rb->tablespace = NULL;
+	rb->tbl_name = NULL;
+	rb->indexdef = NULL;
+	rb->idx_comment = NULL;
+	rb->idx_am = NULL;
+	rb->new_iname = NULL;
+}
+
+
+// phase_begin(): start the timer of the rebuild phase and
+// remember the WAL position if the connection is passed,
+// unknown phases are ignored
+void phase_begin(PGconn *conn, struct rebuild_t *rb, int phase)
+{
+	if (phase < 0 || phase >= PH_COUNT)
+		return;
+
+	rb->phase_start[phase] = now_ms();
+	set_probe_phase(phase, -1);
+
+	if (conn)
+		rb->wal_start[phase] = get_wal_pos(conn);
+}
+
+
+// phase_end(): stop the timer of the rebuild phase
+// and count WAL written since its beginning
+void phase_end(PGconn *conn, struct rebuild_t *rb, int phase)
+{
+	long pos;
+
+	if (phase < 0 || phase >= PH_COUNT)
+		return;
+
+	rb->phase_ms[phase] = now_ms() - rb->phase_start[phase];
+
+	trace_complete(phase == PH_VERIFY && ver_conn ? TRK_VER : TRK_MAIN,
+		       phase_names[phase], "phase", rb->phase_start[phase],
+		       rb->phase_ms[phase], "index", rb->iname);
+
+	if (conn && rb->wal_start[phase] >= 0 && (pos = get_wal_pos(conn)) >= 0)
+		rb->wal_bytes[phase] = pos - rb->wal_start[phase];
+
+	set_probe_phase(PRB_IDLE, phase);
+}
+
+
+// log_phase_timings(): write durations and WAL volume
+// of passed phases
+void log_phase_timings(struct rebuild_t *rb)
+{
+	long wal_total = 0;
+	int i;
+
+	for (i = 0; i < PH_COUNT; i++) {
+		if (rb->phase_ms[i] < 0)
+			continue;
+
+		if (rb->wal_bytes[i] >= 0) {
+			log_write(log_fp, INF, "Phase %s of %s: %f ms, WAL %ld bytes\n",
+				  phase_names[i], rb->iname, rb->phase_ms[i],
+				  rb->wal_bytes[i]);
+			wal_total += rb->wal_bytes[i];
+		} else
+			log_write(log_fp, INF, "Phase %s of %s: %f ms\n",
+				  phase_names[i], rb->iname, rb->phase_ms[i]);
+	}
+
+	log_write(log_fp, INF, "WAL of %s: %ld bytes\n", rb->iname, wal_total);
+
+	if (rb->snap_wait_ms > 0)
+		log_write(log_fp, INF, "Build of %s waited for old snapshots "
+			  "%f ms\n", rb->iname, rb->snap_wait_ms);
+}
+
+
+// get_wal_pos(): current WAL insert position in bytes,
+// -1 if it is unknown (e.g. on a standby)
+long get_wal_pos(PGconn *conn)
+{
+	PGresult *res;
+	long pos = -1;
+
+	if (PQserverVersion(conn) >= 100000)
+		res = PQexec(conn, GET_WAL_POS_SQL);
+	else
+		res = PQexec(conn, GET_XLOG_POS_SQL);
+
+	if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res))
+		pos = atol(PQgetvalue(res, 0, 0));
+
+	PQclear(res);
+	return pos;
+}
+
+
+// finish_rebuild(): log the phases of the finished rebuild,
+// add it to the batch statistic and release its state
+void finish_rebuild(struct rebuild_t *rb, struct batch_stat_t *bs)
+{
+	int i;
+
+	log_phase_timings(rb);
+
+	if (bs) {
+		if (rb->done) {
+			bs->done++;
+			bs->reclaimed += rb->reclaimed;
+
+			if (rb->pred_gain >= 0) {
+				bs->predicted += rb->pred_gain;
+				bs->pred_actual += rb->reclaimed;
+			}
+		} else if (rb->skipped)
+			bs->skipped++;
+		else
+			bs->failed++;
+
+		for (i = 0; i < PH_COUNT; i++)
+			if (rb->wal_bytes[i] > 0)
+				bs->wal_bytes += rb->wal_bytes[i];
+
+		bs->snap_wait_ms += rb->snap_wait_ms;
+
+		if (glob_args.post_analyze && rb->done)
+			add_batch_table(bs, rb->tbl_name);
+
+		if (glob_args.observe > 0 && rb->done)
+			add_io_obs(&bs->obs, &bs->n_obs, rb);
+	}
+
+	free_rebuild(rb);
+}
+
+
+// get_idx_io(): scans and block reads of the index,
+// returns 0 if the index has no statistic
+int get_idx_io(PGconn *conn, char *iname, struct io_stat_t *io)
+{
+	PGresult *res;
+	const char *param_values[1];
+	int ret = 0;
+
+	param_values[0] = iname;
+
+	res = PQexecParams(conn, GET_IDX_IO_SQL, 1, NULL,
+			   param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+	else if (PQntuples(res)) {
+		io->idx_scan = atol(PQgetvalue(res, 0, 0));
+		io->blks_read = atol(PQgetvalue(res, 0, 1));
+		io->blks_hit = atol(PQgetvalue(res, 0, 2));
+		ret = 1;
+	}
+
+	PQclear(res);
+	return ret;
+}
+
+
+// add_io_obs(): watch the I/O of the swapped index
+void add_io_obs(struct io_obs_t **obs, int *n, struct rebuild_t *rb)
+{
+	struct io_obs_t *o;
+
+	if (!rb->io_known)
+		return;
+
+	*obs = (struct io_obs_t*)realloc(*obs, (*n + 1) *
+					 sizeof(struct io_obs_t));
+	o = &(*obs)[(*n)++];
+
+	snprintf(o->iname, sizeof(o->iname), "%s", rb->iname);
+	o->before = rb->io_before;
+	o->base = rb->io_base;
+	o->swap_ms = now_ms();
+}
+
+
+// report_io_obs(): wait until every swapped index has worked
+// for --observe seconds and compare its block reads per scan
+// with the ones of the previous index since the statistic reset
+void report_io_obs(PGconn *conn, struct io_obs_t *obs, int n)
+{
+	struct io_stat_t after;
+	double wait_ms;
+	long scans, blks, reads;
+	long tot_scans[2] = {0, 0}, tot_blks[2] = {0, 0};
+	long tot_reads[2] = {0, 0};
+	int i;
+
+	if (n == 0)
+		return;
+
+	// The last index is swapped last:
+	wait_ms = obs[n - 1].swap_ms + glob_args.observe * 1000.0 - now_ms();
+
+	if (wait_ms > 0) {
+		log_write(log_fp, INF, "Observe I/O of %d rebuilt index(es) "
+			  "for %d sec\n", n, (int)(wait_ms / 1000));
+		print_now_time();
+		printf("Observe I/O of %d rebuilt index(es) for %d sec\n",
+		       n, (int)(wait_ms / 1000));
+		sleep_ms((int)wait_ms);
+	}
+
+	printf("%-40s %10s %10s %10s %10s %10s %10s\n", "index",
+	       "scans", "blks/scan", "reads/scan",
+	       "scans_new", "blks/scan", "reads/scan");
+
+	for (i = 0; i < n; i++) {
+		if (!get_idx_io(conn, obs[i].iname, &after)) {
+			log_write(log_fp, WRN, "No I/O statistic of %s\n",
+				  obs[i].iname);
+			continue;
+		}
+
+		// The statistic has been reset meanwhile:
+		if (after.idx_scan < obs[i].base.idx_scan)
+			memset(&obs[i].base, 0, sizeof(struct io_stat_t));
+
+		scans = after.idx_scan - obs[i].base.idx_scan;
+		reads = after.blks_read - obs[i].base.blks_read;
+		blks = reads + after.blks_hit - obs[i].base.blks_hit;
+
+		tot_scans[0] += obs[i].before.idx_scan;
+		tot_blks[0] += obs[i].before.blks_read + obs[i].before.blks_hit;
+		tot_reads[0] += obs[i].before.blks_read;
+		tot_scans[1] += scans;
+		tot_blks[1] += blks;
+		tot_reads[1] += reads;
+
+		log_write(log_fp, INF, "I/O of %s: before %ld scans, "
+			  "%ld blocks, %ld read; after %ld scans, "
+			  "%ld blocks, %ld read\n", obs[i].iname,
+			  obs[i].before.idx_scan,
+			  obs[i].before.blks_read + obs[i].before.blks_hit,
+			  obs[i].before.blks_read, scans, blks, reads);
+
+		printf("%-40s ", obs[i].iname);
+		print_io_per_scan(obs[i].before.idx_scan,
+				  obs[i].before.blks_read + obs[i].before.blks_hit,
+				  obs[i].before.blks_read);
+		print_io_per_scan(scans, blks, reads);
+		printf("\n");
+	}
+
+	printf("%-40s ", "total");
+	print_io_per_scan(tot_scans[0], tot_blks[0], tot_reads[0]);
+	print_io_per_scan(tot_scans[1], tot_blks[1], tot_reads[1]);
+	printf("\n");
+}
+
+
+// print_io_per_scan(): the columns of the I/O report
+void print_io_per_scan(long scans, long blks, long reads)
+{
+	if (scans > 0)
+		printf("%10ld %10.2f %10.2f ", scans,
+		       (double)blks / scans, (double)reads / scans);
+	else
+		printf("%10ld %10s %10s ", scans, "-", "-");
+}
+
+
+// log_batch_summary(): write totals of the batch
+void log_batch_summary(struct batch_stat_t *bs)
+{
+	char wal_buf[16], recl_buf[16], pred_buf[16], act_buf[16];
+
+	format_size(bs->wal_bytes, wal_buf, sizeof(wal_buf));
+	format_size(bs->reclaimed, recl_buf, sizeof(recl_buf));
+
+	log_write(log_fp, INF, "Batch: %d rebuilt, %d skipped, %d failed, "
+		  "WAL %ld bytes, reclaimed %ld bytes\n",
+		  bs->done, bs->skipped, bs->failed, bs->wal_bytes,
+		  bs->reclaimed);
+
+	print_now_time();
+	printf("Rebuilt %d, skipped %d, failed %d, WAL %s, reclaimed %s",
+	       bs->done, bs->skipped, bs->failed, wal_buf, recl_buf);
+
+	if (bs->predicted > 0) {
+		format_size(bs->predicted, pred_buf, sizeof(pred_buf));
+		format_size(bs->pred_actual, act_buf, sizeof(act_buf));
+
+		log_write(log_fp, INF, "Batch: predicted gain %ld bytes, "
+			  "actual %ld bytes\n", bs->predicted, bs->pred_actual);
+		printf(" (predicted %s, actual %s)", pred_buf, act_buf);
+	}
+
+	if (bs->reclaimed > 0) {
+		log_write(log_fp, INF, "Batch: WAL per reclaimed byte: %f\n",
+			  (double)bs->wal_bytes / bs->reclaimed);
+		printf(", WAL per reclaimed byte %.2f",
+		       (double)bs->wal_bytes / bs->reclaimed);
+	}
+
+	if (bs->snap_wait_ms > 0) {
+		log_write(log_fp, INF, "Batch: waited for old snapshots "
+			  "%f ms\n", bs->snap_wait_ms);
+		printf(", waited for old snapshots %.1f s",
+		       bs->snap_wait_ms / 1000);
+	}
+
+	printf("\n");
+}
+
+
+// build_new_idx(): check the index, create the new
+// one concurrently and check it is valid
+int build_new_idx(PGconn *conn, struct rebuild_t *rb)
+{
+	char *iname = rb->iname;
+	char *creat_cmd = NULL;
+	char *tmp_iname;
+	int ret;
+
+	log_write(log_fp, INF, "== Start to rebuild index ==: %s\n", iname);
+
+	phase_begin(conn, rb, PH_PREPARE);
+
+	// Clean up the new index left by a failed run, it may
+	// also finish the swap if the old index is gone:
+	if (glob_args.reconcile) {
+		tmp_iname = make_new_iname(iname);
+		ret = reconcile_idx(conn, tmp_iname);
+		free(tmp_iname);
+
+		// The leftover was a rebuilt copy, it is in place now:
+		if (ret == SWAPPED) {
+			log_write(log_fp, INF, "Index is rebuilt by the "
+				  "finished swap, skip\n");
+			printf("Index %s is skipped, the swap of its "
+			       "rebuilt copy is finished\n", iname);
+			rb->skipped = 1;
+			return FAIL;
+		}
+	}
+
+	// Check the index is into the database:
+	ret = check_idx_name(conn, iname);
+	if (ret == QUERY_ERR) {
+		log_write(log_fp, ERR, "Can not check the index. Exit\n");
+		return FAIL;
+
+	} else if (ret == FAIL) {
+		log_write(log_fp, ERR,
+			  "Index with specified index name not found. Exit\n");
+		return FAIL;
+
+	} else if (ret == 2) {
+		log_write(log_fp, ERR, "Index name is too long. Exit\n");
+		return FAIL;
+	}
+
+	// Check index validity:
+	if ((ret = check_idx_validity(conn, iname)) != 1) {
+		log_write(log_fp, ERR, ret == QUERY_ERR ?
+			  "Can not check index validity. Exit\n" :
+			  "Index is invalid. Exit\n");
+		return FAIL;
+	}
+
+	// Get the table of the index:
+	if ((rb->tbl_name = get_idx_table(conn, iname)) == NULL) {
+		log_write(log_fp, ERR, "Table of index not found. Exit\n");
+		return FAIL;
+	}
+
+	// Get the access method of the index:
+	if ((rb->idx_am = get_idx_am(conn, iname)) == NULL) {
+		log_write(log_fp, ERR, "Access method not found. Exit\n");
+		return FAIL;
+	}
+	log_write(log_fp, INF, "Access method: %s\n", rb->idx_am);
+
+	if (!strcmp(rb->idx_am, "hash") && PQserverVersion(conn) < 100000)
+		log_write(log_fp, WRN,
+			  "Hash indexes are not WAL-logged before "
+			  "PostgreSQL 10, the new one will not reach replicas\n");
+
+	// Primary key and unique indexes swap with their constraint:
+	if ((ret = get_idx_contype(conn, iname)) == QUERY_ERR) {
+		log_write(log_fp, ERR, "Can not get the constraint. Exit\n");
+		return FAIL;
+	}
+
+	rb->contype = ret;
+	if (rb->contype == 'x') {
+		log_write(log_fp, ERR,
+			  "Index backs an exclusion constraint. Exit\n");
+		return FAIL;
+	} else if (rb->contype)
+		log_write(log_fp, INF, "Index backs a %s constraint\n",
+			  rb->contype == 'p' ? "primary key" : "unique");
+
+	// Get size of the current index for statistic:
+	if ((rb->prev_size = get_rel_size(conn, iname)) < 0) {
+		log_write(log_fp, ERR, "Can not get the index size. Exit\n");
+		return FAIL;
+	}
+
+	// Skip the index if the rebuild does not pay off:
+	if (glob_args.min_gain || glob_args.min_gain_pct) {
+		rb->pred_gain = estimate_gain(conn, rb);
+
+		if (rb->pred_gain < 0)
+			log_write(log_fp, WRN,
+				  "Gain is unknown, rebuild anyway\n");
+		else if (rb->pred_gain < glob_args.min_gain ||
+			 100.0 * rb->pred_gain < glob_args.min_gain_pct *
+			 rb->prev_size) {
+			log_write(log_fp, INF,
+				  "Predicted gain %ld of %ld bytes is below "
+				  "--min-gain, skip\n",
+				  rb->pred_gain, rb->prev_size);
+			printf("Index %s is skipped, the gain is too small\n",
+			       iname);
+			rb->skipped = 1;
+			return FAIL;
+		} else
+			log_write(log_fp, INF,
+				  "Predicted gain %ld of %ld bytes\n",
+				  rb->pred_gain, rb->prev_size);
+	}
+
+	// Get the index definition:
+	if ((rb->indexdef = get_indexdef(conn, iname)) != NULL)
+		log_write(log_fp, INF, "Indexdef: %s\n", rb->indexdef);
+	else {
+		log_write(log_fp, ERR, "Indexdef not found. Exit\n");
+		return FAIL;
+	}
+
+	// Get the index comment if it exists:
+	if (!get_idx_comment(conn, iname, &rb->idx_comment)) {
+		log_write(log_fp, ERR, "Can not get the comment. Exit\n");
+		return FAIL;
+	} else if (rb->idx_comment != NULL)
+		log_write(log_fp, INF,
+			  "Comment of index: '%s'\n", rb->idx_comment);
+	else
+		log_write(log_fp, INF,
+			  "Comment of index not found. Continue\n");
+
+	// Make a new index name:
+	rb->new_iname = make_new_iname(iname);
+	log_write(log_fp, INF, "Temporary new index name: %s\n",
+		  rb->new_iname);
+
+	// Check the name for the new index:
+	if ((ret = check_idx_name(conn, rb->new_iname)) != FAIL) {
+		log_write(log_fp, ERR, ret == QUERY_ERR ?
+			  "Can not check the name %s. Exit\n" :
+			  "Index with name %s exists. Exit\n", rb->new_iname);
+		return FAIL;
+	}
+
+	// Make a creation command for the new index:
+	if ((creat_cmd = make_creat_cmd(rb->new_iname, rb->indexdef)) == NULL) {
+		log_write(log_fp, ERR,
+			  "Can not make creation command for new index. Exit\n");
+		return FAIL;
+	}
+
+	// Choose the fillfactor by the write activity:
+	if (glob_args.auto_ff && choose_fillfactor(conn, rb))
+		creat_cmd = set_fillfactor(creat_cmd, rb->fillfactor);
+
+	// Keep the tablespace of the index or move it by heat:
+	if (choose_tablespace(conn, rb) && rb->tablespace)
+		creat_cmd = set_tablespace(conn, creat_cmd, rb->tablespace);
+
+	// Old transactions would stall the build:
+	if (!wait_old_xacts(conn)) {
+		log_write(log_fp, ERR,
+			  "Old transactions are still running. Exit\n");
+		free(creat_cmd);
+		return FAIL;
+	}
+
+	// Do not compete with a vacuum of the table:
+	if (!wait_vacuum(conn, rb->tbl_name)) {
+		log_write(log_fp, WRN, "Table %s is still vacuumed, "
+			  "skip the index\n", rb->tbl_name);
+		printf("Index %s is skipped, its table is vacuumed\n",
+		       iname);
+		free(creat_cmd);
+		rb->skipped = 1;
+		return FAIL;
+	}
+
+	phase_end(conn, rb, PH_PREPARE);
+
+	// Create a new index:
+	log_write(log_fp, INF, "Try to create new index\n");
+
+	// Mark the new index as ours for --reconcile:
+	mark_build(PQdb(conn), rb->new_iname, BUILD_STARTED);
+
+	phase_begin(conn, rb, PH_BUILD);
+	ret = create_idx(conn, creat_cmd, &rb->snap_wait_ms);
+	phase_end(conn, rb, PH_BUILD);
+	free(creat_cmd);
+
+	if (ret == 1)
+		log_write(log_fp, INF, "Index has been created\n");
+	else {
+		log_write(log_fp, ERR, "Creation FAILED. Exit\n");
+		return FAIL;
+	}
+
+	// Check the new index validity:
+	if (check_idx_validity(conn, rb->new_iname) != 1) {
+		log_write(log_fp, ERR,
+			  "New index is invalid. Drop it manually. Exit\n");
+		return FAIL;
+	}
+
+	// Check the new index is the same as the old one:
+	if (!check_idx_match(conn, iname, rb->new_iname)) {
+		log_write(log_fp, ERR,
+			  "New %s index differs from the old one. "
+			  "Drop it manually. Exit\n", rb->idx_am);
+		return FAIL;
+	}
+
+	// Add the comment if it was:
+	if (rb->idx_comment != NULL) {
+		if (add_comment(conn, rb->new_iname, rb->idx_comment))
+			log_write(log_fp, INF, "Comment has been added\n");
+		else 
+			log_write(log_fp, WRN, "Comment is not added\n");
+	}
+
+	return SUCCESS;
+}
+
+
+// send_verify(): start the amcheck verification of the new
+// index on the connection without waiting for the result
+int send_verify(PGconn *conn, struct rebuild_t *rb)
+{
+	const char *param_values[1];
+
+	rb->verify_sent = 0;
+
+	// amcheck verifies btree indexes only:
+	if (strcmp(rb->idx_am, "btree")) {
+		log_write(log_fp, INF,
+			  "Skip verification of %s index %s\n",
+			  rb->idx_am, rb->new_iname);
+		return SUCCESS;
+	}
+
+	param_values[0] = rb->new_iname;
+
+	log_write(log_fp, INF, "Try to verify new index %s\n", rb->new_iname);
+
+	phase_begin(NULL, rb, PH_VERIFY);
+
+	if (!PQsendQueryParams(conn, VERIFY_IDX_SQL, 1, NULL,
+			       param_values, NULL, NULL, 0)) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		return FAIL;
+	}
+
+	rb->verify_sent = 1;
+	return SUCCESS;
+}
+
+
+// wait_verify(): wait for the result of send_verify()
+int wait_verify(PGconn *conn, struct rebuild_t *rb)
+{
+	PGresult *res;
+	int ret = SUCCESS;
+
+	if (!rb->verify_sent)
+		return SUCCESS;
+
+	while ((res = PQgetResult(conn)) != NULL) {
+		if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+			log_write(log_fp, ERR, "Verification FAILED: %s\n",
+				  PQerrorMessage(conn));
+			ret = FAIL;
+		}
+		PQclear(res);
+	}
+
+	phase_end(NULL, rb, PH_VERIFY);
+	rb->verify_sent = 0;
+
+	if (ret == SUCCESS)
+		log_write(log_fp, INF, "New index %s has been verified\n",
+			  rb->new_iname);
+	else
+		log_write(log_fp, ERR,
+			  "New index %s is corrupted. Drop it manually\n",
+			  rb->new_iname);
+
+	return ret;
+}
+
+
+// swap_new_idx(): drop the old index and
+// give its name to the new one
+int swap_new_idx(PGconn *conn, struct rebuild_t *rb)
+{
+	long next_size;
+	int ret = SUCCESS;
+
+	phase_begin(conn, rb, PH_SWAP);
+
+	// Load the new index into shared buffers before it takes over:
+	if (glob_args.prewarm) {
+		log_write(log_fp, INF, "Try to prewarm new index\n");
+
+		if (!prewarm_idx(conn, rb->new_iname, glob_args.prewarm_budget))
+			log_write(log_fp, WRN, "Prewarm is skipped\n");
+	}
+
+	// Counters for the I/O report, the new index has been
+	// read by the validation and the prewarm already:
+	if (glob_args.observe > 0) {
+		rb->io_known = get_idx_io(conn, rb->iname, &rb->io_before) &&
+			       get_idx_io(conn, rb->new_iname, &rb->io_base);
+		if (!rb->io_known)
+			log_write(log_fp, WRN, "No I/O statistic of the index, "
+				  "it is not observed\n");
+	}
+
+	if (rb->contype) {
+		// Move the constraint, it drops the previous index:
+		log_write(log_fp, INF, "Try to swap the constraint\n");
+
+		if (swap_constraint(conn, rb))
+			log_write(log_fp, INF,
+				  "Constraint has been swapped\n");
+		else {
+			ret = FAIL;
+			log_write(log_fp, ERR, "Can not swap constraint\n");
+		}
+
+	} else {
+		// Drop the index:
+		log_write(log_fp, INF, "Try to drop previous index\n");
+
+		if (drop_idx(conn, rb->iname) == 1) {
+			log_write(log_fp, INF, "Index has been dropped\n");
+
+			// Rename the index:
+			log_write(log_fp, INF,
+				  "Try to rename new index like previous\n");
+
+			// Set statement_timeout for RENAME:
+			set_statement_timeout(conn, glob_args.st_timeout);
+
+			if (rename_idx(conn, rb->new_iname, rb->iname)) {
+				log_write(log_fp, INF,
+					  "Index has been renamed\n");
+			} else {
+				log_write(log_fp, ERR, "Can not rename index\n");
+				ret = FAIL;
+			}
+
+		} else {
+			ret = FAIL;
+			log_write(log_fp, ERR, "Can not drop index\n");
+		}
+	}
+
+	if (ret == SUCCESS) {
+		// Get size of the rebuilt index for statistic:
+		next_size = get_rel_size(conn, rb->iname);
+		// The swap is done anyway, only the statistic is lost:
+		if (next_size < 0)
+			next_size = rb->prev_size;
+		rb->reclaimed = rb->prev_size - next_size;
+		log_write(log_fp, INF,
+			  "Prev idx size: %ld, new idx size: %ld, diff: %ld\n",
+			  rb->prev_size, next_size, rb->reclaimed);
+
+		if (rb->pred_gain >= 0)
+			log_write(log_fp, INF,
+				  "Predicted gain: %ld, actual gain: %ld\n",
+				  rb->pred_gain, rb->reclaimed);
+
+		rb->done = 1;
+		mark_build(PQdb(conn), rb->new_iname, BUILD_ENDED);
+
+		if (glob_args.auto_ff)
+			save_rebuild(PQdb(conn), rb, next_size);
+	}
+
+	set_statement_timeout(conn, "0");
+
+	phase_end(conn, rb, PH_SWAP);
+
+	if (ret == SUCCESS)
+		log_write(log_fp, INF, "== Rebuilding is done ==\n");
+	else
+		log_write(log_fp, ERR, "== Rebuilding failed ==\n");
+
+	return ret;
+}
+
+
+// get_idx_contype(): get the type of the constraint
+// backed by the index, 0 if there is no one
+int get_idx_contype(PGconn *conn, char *iname)
+{
+	PGresult *res;
+	const char *param_values[1];
+	int contype = 0;
+
+	param_values[0] = iname;
+
+	res = PQexecParams(conn, GET_IDX_CONTYPE_SQL, 1, NULL,
+			   param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return QUERY_ERR;
+	}
+
+	if (PQntuples(res))
+		contype = PQgetvalue(res, 0, 0)[0];
+
+	PQclear(res);
+	return contype;
+}
+
+
+// swap_constraint(): move the primary key or unique constraint
+// to the new index in one transaction. Foreign keys referencing
+// the old index are dropped and added back as NOT VALID, so the
+// swap holds its locks for a short time only; they are validated
+// after the commit without blocking writes. The new index takes
+// the constraint name, which is the name of the old index
+int swap_constraint(PGconn *conn, struct rebuild_t *rb)
+{
+	PGresult *res, *fk_res;
+	const char *param_values[2];
+	char *cmd;
+	size_t len;
+	int i, ret;
+
+	param_values[0] = rb->iname;
+	param_values[1] = rb->new_iname;
+
+	res = PQexecParams(conn, GET_CONSTR_SWAP_SQL, 2, NULL,
+			   param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK || !PQntuples(res)) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return FAIL;
+	}
+
+	fk_res = PQexecParams(conn, PQserverVersion(conn) >= 110000 ?
+			      GET_FK_CMDS_SQL : GET_FK_CMDS_10_SQL, 1, NULL,
+			      param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(fk_res) != PGRES_TUPLES_OK) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(fk_res);
+		PQclear(res);
+		return FAIL;
+	}
+
+	// Statements of one query string run in one transaction:
+	len = strlen(PQgetvalue(res, 0, 0)) + strlen(PQgetvalue(res, 0, 1)) + 3;
+	for (i = 0; i < PQntuples(fk_res); i++)
+		len += strlen(PQgetvalue(fk_res, i, 0)) +
+		       strlen(PQgetvalue(fk_res, i, 1)) +
+		       strlen(PQgetvalue(fk_res, i, 3)) + 6;
+
+	cmd = (char*)malloc(len * sizeof(char));
+	cmd[0] = '\0';
+
+	for (i = 0; i < PQntuples(fk_res); i++) {
+		strcat(cmd, PQgetvalue(fk_res, i, 0));
+		strcat(cmd, "; ");
+	}
+
+	strcat(cmd, PQgetvalue(res, 0, 0));
+	strcat(cmd, "; ");
+	strcat(cmd, PQgetvalue(res, 0, 1));
+
+	for (i = 0; i < PQntuples(fk_res); i++) {
+		strcat(cmd, "; ");
+		strcat(cmd, PQgetvalue(fk_res, i, 1));
+		strcat(cmd, "; ");
+		strcat(cmd, PQgetvalue(fk_res, i, 3));
+	}
+
+	PQclear(res);
+
+	log_write(log_fp, INF, "%s\n", cmd);
+
+	// Set statement_timeout for the swap:
+	set_statement_timeout(conn, glob_args.st_timeout);
+
+	ret = exec_swap_cmd(conn, cmd);
+	free(cmd);
+
+	set_statement_timeout(conn, "0");
+
+	// Validate foreign keys, it takes no exclusive locks:
+	for (i = 0; ret == SUCCESS && i < PQntuples(fk_res); i++) {
+		if (PQgetisnull(fk_res, i, 2))
+			continue;
+
+		log_write(log_fp, INF, "%s\n", PQgetvalue(fk_res, i, 2));
+
+		res = PQexec(conn, PQgetvalue(fk_res, i, 2));
+
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			log_write(log_fp, WRN,
+				  "Foreign key is left NOT VALID: %s\n",
+				  PQerrorMessage(conn));
+		PQclear(res);
+	}
+
+	PQclear(fk_res);
+	return ret;
+}
+
+
+// reconcile_idx(): clean up "new_" leftovers of failed rebuilds,
+// all of them or the one with the passed name. A valid index
+// built by pg_reindex (marked in the history file) finishes its
+// swap when the old index is gone or has the same definition,
+// an invalid one is dropped unless another session is still
+// building it (it holds locks on the index or table). Ones that
+// are ready are updated on every write, the write overhead
+// removed is reported as index entries per second. Returns
+// SWAPPED if a swap was finished and nothing is left
+int reconcile_idx(PGconn *conn, char *iname)
+{
+	PGresult *res;
+	struct rebuild_t rb;
+	const char *param_values[1];
+	char *name, *base, buf[16];
+	long size, freed = 0;
+	double writes, writes_freed = 0;
+	int i, valid, ready, marked, contype, removed = 0, left = 0;
+	int swapped = 0;
+
+	param_values[0] = iname;
+
+	res = PQexecParams(conn, GET_LEFTOVER_IDX_SQL, 1, NULL,
+			   param_values, NULL, NULL, 0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		log_write(log_fp, ERR, "QUERY failed: %s\n",
+			  PQerrorMessage(conn));
+		PQclear(res);
+		return FAIL;
+	}
+
+	for (i = 0; i < PQntuples(res); i++) {
+		name = PQgetvalue(res, i, 0);
+		valid = PQgetvalue(res, i, 1)[0] == 't';
+		ready = PQgetvalue(res, i, 2)[0] == 't';
+		size = atol(PQgetvalue(res, i, 3));
+		base = PQgetvalue(res, i, 4);
+		writes = ready ? atof(PQgetvalue(res, i, 6)) : 0;
+		marked = check_build_mark(PQdb(conn), name);
+
+		format_size(size, buf, sizeof(buf));
+
+		if (PQgetvalue(res, i, 7)[0] == 't') {
+			log_write(log_fp, WRN,
+				  "Index %s is in use by another session, skip\n",
+				  name);
+			printf("%s (%s): in use by another session, skipped\n",
+			       name, buf);
+			left++;
+			continue;
+		}
+
+		if (!valid) {
+			// A failed CREATE INDEX CONCURRENTLY:
+			log_write(log_fp, INF, "Drop invalid index %s\n", name);
+
+			if (drop_idx(conn, name) == SUCCESS) {
+				printf("%s (%s): invalid, dropped\n", name, buf);
+				mark_build(PQdb(conn), name, BUILD_ENDED);
+				freed += size;
+				writes_freed += writes;
+				removed++;
+			} else {
+				printf("%s (%s): invalid, can not drop\n", name, buf);
+				left++;
+			}
+
+		} else if (!marked) {
+			// A valid index of the application named new_:
+			log_write(log_fp, WRN,
+				  "Index %s is not built by pg_reindex, "
+				  "leave it\n", name);
+			printf("%s (%s): valid, not built by pg_reindex, "
+			       "left as is\n", name, buf);
+			left++;
+
+		} else if (PQgetvalue(res, i, 5)[0] != 't') {
+			// The old index is dropped, only the rename is left:
+			log_write(log_fp, INF,
+				  "Finish the swap of %s, %s is gone\n", name, base);
+
+			set_statement_timeout(conn, glob_args.st_timeout);
+
+			if (rename_idx(conn, name, base) == SUCCESS) {
+				printf("%s (%s): renamed to %s\n", name, buf, base);
+				mark_build(PQdb(conn), name, BUILD_ENDED);
+				removed++;
+				swapped++;
+			} else {
+				printf("%s (%s): can not rename to %s\n",
+				       name, buf, base);
+				left++;
+			}
+
+			set_statement_timeout(conn, "0");
+
+		} else if (check_idx_match(conn, base, name)) {
+			// The new index is built, the swap is not started:
+			log_write(log_fp, INF,
+				  "Finish the swap of %s and %s\n", name, base);
+
+			init_rebuild(&rb, base);
+			rb.new_iname = (char*)malloc(strlen(name) + 1);
+			strcpy(rb.new_iname, name);
+			rb.prev_size = get_rel_size(conn, base);
+			contype = get_idx_contype(conn, base);
+			rb.contype = contype == QUERY_ERR ? 0 : contype;
+
+			if (rb.prev_size >= 0 && contype != QUERY_ERR &&
+			    swap_new_idx(conn, &rb) == SUCCESS) {
+				printf("%s (%s): swapped with %s\n", name, buf, base);
+				freed += rb.prev_size;
+				writes_freed += atof(PQgetvalue(res, i, 6));
+				removed++;
+				swapped++;
+			} else {
+				printf("%s (%s): can not swap with %s\n",
+				       name, buf, base);
+				left++;
+			}
+
+			free_rebuild(&rb);
+
+		} else {
+			log_write(log_fp, WRN,
+				  "Index %s is valid and not a copy of %s, "
+				  "leave it\n", name, base);
+			printf("%s (%s): valid, left as is\n", name, buf);
+			left++;
+		}
+	}
+
+	PQclear(res);
+
+	format_size(freed, buf, sizeof(buf));
+
+	if (removed || left || !iname)
+		printf("Reconciled %d index(es), left %d, removed %s "
+		       "and %.1f index writes/s\n",
+		       removed, left, buf, writes_freed);
+
+	log_write(log_fp, INF,
+		  "Reconciled %d index(es), left %d, removed %ld bytes "
+		  "and %f index writes/s\n",
+		  removed, left, freed, writes_freed);
+
+	if (left)
+		return FAIL;
+
+	return swapped ? SWAPPED : SUCCESS;
+}
+
+
+/*
+ * LATENCY PROBE FUNCTIONS BELOW
+ */
+
+// Probe state shared with the probe thread:
+static pthread_mutex_t probe_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t probe_thread;
+static struct hist_t probe_hist[PRB_COUNT];	// latencies in usec
+static long probe_errors = 0;
+static int probe_phase = PRB_IDLE;
+static int probe_running = 0;
+static volatile sig_atomic_t probe_stop = 0;
+
+
+// start_probe(): start the probe thread and
+// measure the baseline latency
+int start_probe(void)
+{
+	int i;
+
+	if (glob_args.probe_rate <= 0)
+		glob_args.probe_rate = PRB_RATE;
+
+	for (i = 0; i < PRB_COUNT; i++)
+		hist_init(&probe_hist[i]);
+
+	probe_phase = PRB_BASELINE;
+	probe_stop = 0;
+
+	if (pthread_create(&probe_thread, NULL, probe_worker, NULL)) {
+		log_write(log_fp, ERR, "Can not start the probe\n");
+		return FAIL;
+	}
+	probe_running = 1;
+
+	log_write(log_fp, INF, "Probe: measure baseline for %d sec\n",
+		  glob_args.probe_baseline);
+	sleep_ms(glob_args.probe_baseline * 1000);
+
+	set_probe_phase(PRB_IDLE, -1);
+	return SUCCESS;
+}
+
+
+// stop_probe(): stop the probe thread and report
+// latency percentiles per phase next to the baseline
+void stop_probe(void)
+{
+	static const int order[] = {PRB_BASELINE, PH_PREPARE, PH_BUILD,
+				    PH_VERIFY, PH_SWAP, PRB_IDLE};
+	struct hist_t *h;
+	int i, n;
+
+	if (!probe_running)
+		return;
+
+	probe_stop = 1;
+	pthread_join(probe_thread, NULL);
+	probe_running = 0;
+
+	printf("%-9s|%8s|%10s|%10s|%10s\n", "phase", "queries",
+	       "p50 ms", "p99 ms", "max ms");
+
+	for (n = 0; n < PRB_COUNT; n++) {
+		i = order[n];
+		h = &probe_hist[i];
+		if (!h->count)
+			continue;
+
+		printf("%-9s|%8ld|%10.3f|%10.3f|%10.3f\n",
+		       probe_phase_names[i], h->count,
+		       hist_quantile(h, 0.5) / 1000,
+		       hist_quantile(h, 0.99) / 1000, h->max / 1000);
+
+		log_write(log_fp, INF, "Probe %s: %ld queries, p50 %f ms, "
+			  "p99 %f ms, max %f ms\n", probe_phase_names[i],
+			  h->count, hist_quantile(h, 0.5) / 1000,
+			  hist_quantile(h, 0.99) / 1000, h->max / 1000);
+	}
+
+	if (probe_errors)
+		log_write(log_fp, WRN, "Probe: %ld queries failed\n",
+			  probe_errors);
+}
+
+
+// set_probe_phase(): attribute next probes to the phase;
+// if from is not -1, only when the current phase is from
+// (the verification of one index may overlap with the
+// build of the next one)
+void set_probe_phase(int phase, int from)
+{
+	pthread_mutex_lock(&probe_lock);
+	if (from == -1 || probe_phase == from)
+		probe_phase = phase;
+	pthread_mutex_unlock(&probe_lock);
+}
+
+
+// probe_worker(): run the probe query at a fixed rate on its
+// own connection. A probe that takes longer than the interval
+// also stands for the probes that could not be sent meanwhile
+// (as if they waited in the queue behind it)
+void *probe_worker(void *arg)
+{
+	PGconn *pconn;
+	PGresult *res;
+	double interval, start, lat, next;
+	int ok;
+
+	(void)arg;
+
+	pconn = PQconnectdb(db_conninfo);
+	if (PQstatus(pconn) != CONNECTION_OK) {
+		PQfinish(pconn);
+		pthread_mutex_lock(&probe_lock);
+		probe_errors++;
+		pthread_mutex_unlock(&probe_lock);
+		return NULL;
+	}
+
+	interval = 1000.0 / glob_args.probe_rate;
+	next = now_ms();
+
+	while (!probe_stop) {
+		start = now_ms();
+		res = PQexec(pconn, glob_args.probe_sql);
+		lat = now_ms() - start;
+		ok = PQresultStatus(res) == PGRES_TUPLES_OK ||
+		     PQresultStatus(res) == PGRES_COMMAND_OK;
+		PQclear(res);
+
+		pthread_mutex_lock(&probe_lock);
+		if (ok) {
+			hist_add(&probe_hist[probe_phase], lat * 1000);
+
+			// Correct the coordinated omission:
+			for (lat -= interval; lat > 0; lat -= interval)
+				hist_add(&probe_hist[probe_phase], lat * 1000);
+		} else
+			probe_errors++;
+		pthread_mutex_unlock(&probe_lock);
+
+		if (!ok && PQstatus(pconn) != CONNECTION_OK)
+			PQreset(pconn);
+
+		next += interval;
+		if (next > now_ms())
+			sleep_ms((int)(next - now_ms()));
+		else
+			next = now_ms();
+	}
+
+	PQfinish(pconn);
+	return NULL;
+}
+
+
+/*
+ * DAEMON FUNCTIONS BELOW
+ */
 
-	return idef;
-}
+// Daemon state shared by the socket loop and the worker:
+static pthread_mutex_t dmn_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dmn_cond = PTHREAD_COND_INITIALIZER;
+static struct dmn_job_t *dmn_queue = NULL;	// queued jobs, FIFO
+static struct dmn_job_t *dmn_running = NULL;	// the job in work
+static struct dmn_job_t *dmn_history = NULL;	// finished jobs
+static struct dmn_pool_t *dmn_pool = NULL;
+static int dmn_next_id = 1;
+static int dmn_clients = 0;			// clients being served
+static pthread_cond_t dmn_client_cond = PTHREAD_COND_INITIALIZER;
+static volatile sig_atomic_t dmn_stop = 0;
 
 
-// get_idx_comment(): if the comment of index exists, get it
-char *get_idx_comment(PGconn *conn, char *iname)
+static void dmn_on_signal(int sig)
 {
-	PGresult *res;
-	const char *param_values[1];
-	char *icomm;
+	(void)sig;
+	dmn_stop = 1;
+}
 
-	param_values[0] = iname;
 
-	res = PQexecParams(conn,
-			   GET_ICOMMENT_SQL,
-			   1,
-			   NULL,
-			   param_values,
-			   NULL,
-			   NULL,
-			   0);
+// run_daemon(): listen on the control socket, serve each
+// client in its own thread and pass accepted jobs to the
+// worker thread, which runs them one by one over pooled
+// connections. Jobs still queued on shutdown are saved
+// and queued again on the next start
+int run_daemon(PGconn *conn)
+{
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	struct pollfd pfd;
+	struct dmn_pool_t *pool;
+	struct dmn_job_t *job;
+	pthread_t worker, client;
+	pthread_attr_t attr;
+	time_t now;
+	char reply[DMN_CMD_BUFSIZE];
+	mode_t old_mask;
+	int lfd, cfd, ret;
+
+	if (strlen(glob_args.sock_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path is too long\n");
+		exit_nicely(conn);
+	}
 
-	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-		log_write(log_fp, ERR, "QUERY failed: %s\n",
-			  PQerrorMessage(conn));
-		PQclear(res);
+	// The connection of the -d database is the first in the pool:
+	pool = (struct dmn_pool_t*)calloc(1, sizeof(struct dmn_pool_t));
+	snprintf(pool->db_name, sizeof(pool->db_name), "%s", glob_args.db_name);
+	pool->conninfo = db_conninfo;
+	pool->conn = conn;
+	dmn_pool = pool;
+
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (lfd < 0) {
+		fprintf(stderr, "Could not create socket\n");
 		exit_nicely(conn);
 	}
 
-	if (PQntuples(res) > 0) {
-		// Comment exists:
-		if (strcmp(PQgetvalue(res, 0, 0),"\0")) {
-			icomm = (char*)malloc(strlen(PQgetvalue(res, 0, 0)) *
-					      sizeof(char) + 1);
-			strcpy(icomm, PQgetvalue(res, 0, 0));
-		} else {
-			icomm = NULL;
-		}
-	} else 
-		icomm = NULL;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, glob_args.sock_path);
+	unlink(glob_args.sock_path);
 
-	PQclear(res);
-	return icomm;
-}
+	// Only the owner may connect, there is no window between
+	// bind() and a later chmod() for other users:
+	old_mask = umask(S_IRWXG | S_IRWXO);
+	ret = bind(lfd, (struct sockaddr*)&addr, sizeof(addr));
+	umask(old_mask);
 
+	if (ret < 0 || listen(lfd, 16) < 0) {
+		fprintf(stderr, "Could not listen on %s\n", glob_args.sock_path);
+		log_write(log_fp, ERR,
+			  "Could not listen on %s\n", glob_args.sock_path);
+		close(lfd);
+		exit_nicely(conn);
+	}
 
-// make_new_iname(): make a temporary name for a new index
-char *make_new_iname(char *iname)
-{
-	char *new_iname;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = dmn_on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
 
-	new_iname = (char*)malloc(67 * sizeof(char));
+	log_write(log_fp, INF, "Daemon is listening on %s\n",
+		  glob_args.sock_path);
 
-	strcpy(new_iname, "new_");
-	strcat(new_iname, iname);
+	dmn_load_queue();
+	pthread_create(&worker, NULL, dmn_worker, NULL);
 
-	return new_iname;
-}
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 
+	pfd.fd = lfd;
+	pfd.events = POLLIN;
 
-// make_creat_cmd: make a creation command
-char *make_creat_cmd(char *new_iname, char *idef)
-{
-	unsigned i = 0;
-	unsigned space_count = 0;
-	char *cmd = NULL;
-	char *buf = NULL;
+	while (!dmn_stop) {
+		if (poll(&pfd, 1, DMN_POLL_MS) > 0 && (pfd.revents & POLLIN)) {
+			cfd = accept(lfd, NULL, NULL);
+			if (cfd >= 0) {
+				pthread_mutex_lock(&dmn_lock);
+				dmn_clients++;
+				pthread_mutex_unlock(&dmn_lock);
 
-	cmd = (char*)malloc(1024 * sizeof(char));
-	buf = (char*)malloc(1024 * sizeof(char));
+				if (pthread_create(&client, &attr, dmn_client_worker,
+						   (void*)(intptr_t)cfd)) {
+					log_write(log_fp, ERR,
+						  "Can not start a client thread\n");
+					close(cfd);
+					pthread_mutex_lock(&dmn_lock);
+					dmn_clients--;
+					pthread_mutex_unlock(&dmn_lock);
+				}
+			}
+		}
 
-	strcpy(cmd, "CREATE INDEX CONCURRENTLY ");
+		// Schedule bloat scans of the pooled databases:
+		if (glob_args.scan_interval > 0) {
+			now = time(NULL);
 
-	space_count = 0;
-	for (i = 0; idef[i] != '\0'; i++) {
-		if (idef[i] == ' ')
-			space_count++;
+			pthread_mutex_lock(&dmn_lock);
+			for (pool = dmn_pool; pool; pool = pool->next) {
+				if (now - pool->last_scan < glob_args.scan_interval)
+					continue;
 
-		if (space_count >= 3) {
-			strcpy(buf, &idef[i]);
-			break;
+				pool->last_scan = now;
+				pthread_mutex_unlock(&dmn_lock);
+				dmn_enqueue(JOB_SCAN, pool->db_name, "", reply);
+				pthread_mutex_lock(&dmn_lock);
+			}
+			pthread_mutex_unlock(&dmn_lock);
 		}
 	}
 
-	strcat(cmd, new_iname);
-	strcat(cmd, buf);
+	close(lfd);
+	unlink(glob_args.sock_path);
+	pthread_attr_destroy(&attr);
 
-	free(buf);
+	// Let the clients being served and the worker finish:
+	pthread_mutex_lock(&dmn_lock);
+	while (dmn_clients > 0)
+		pthread_cond_wait(&dmn_client_cond, &dmn_lock);
+	pthread_cond_signal(&dmn_cond);
+	pthread_mutex_unlock(&dmn_lock);
+	pthread_join(worker, NULL);
 
-	return cmd;
-}
+	dmn_save_queue();
 
+	while (dmn_queue) {
+		job = dmn_queue;
+		dmn_queue = job->next;
+		free(job);
+	}
 
-// create_idx(): create index
-int create_idx(PGconn *conn, char *cmd)
-{
-	PGresult *res;
+	while (dmn_history) {
+		job = dmn_history;
+		dmn_history = job->next;
+		free(job);
+	}
 
-	log_write(log_fp, INF, "%s\n", cmd);
+	while (dmn_pool) {
+		pool = dmn_pool;
+		dmn_pool = pool->next;
 
-	res = PQexec(conn, cmd);
-	if (PQresultStatus(res) == PGRES_COMMAND_OK) {
-		PQclear(res);
-		return 1;
-	} else {
-		log_write(log_fp, ERR, "QUERY failed: %s\n",
-			  PQerrorMessage(conn));
-		PQclear(res);
-		return 0;
+		if (pool->mon)
+			PQfinish(pool->mon);
+		PQfinish(pool->conn);
+		if (pool->conninfo != db_conninfo)
+			free(pool->conninfo);
+		free(pool);
 	}
+
+	log_write(log_fp, INF, "Daemon is stopped\n");
+	return 0;
 }
 
 
-// add_comment(): add comment for index
-int add_comment(PGconn *conn, char *iname, char *comment)
+// dmn_client_worker(): serve one client connection
+void *dmn_client_worker(void *arg)
 {
-	PGresult *res;
-	char *str = "COMMENT ON INDEX ";
-	char *add_comment_sql;
+	int fd = (int)(intptr_t)arg;
 
-	add_comment_sql = malloc((strlen(str) + 7 +
-				  strlen(comment) + strlen(iname)) *
-				  sizeof(char));
+	dmn_handle_client(fd);
+	close(fd);
 
-	strcpy(add_comment_sql, str);
-	strcat(add_comment_sql, iname);
-	strcat(add_comment_sql, " IS '");
-	strcat(add_comment_sql, comment);
-	strcat(add_comment_sql, "'");
+	pthread_mutex_lock(&dmn_lock);
+	dmn_clients--;
+	pthread_cond_signal(&dmn_client_cond);
+	pthread_mutex_unlock(&dmn_lock);
 
-	res = PQexec(conn, add_comment_sql);
-	free(add_comment_sql);
+	return NULL;
+}
 
-	if (PQresultStatus(res) == PGRES_COMMAND_OK) {
-		PQclear(res);
-		return 1;
+
+// dmn_handle_client(): read one command from
+// the client, execute it and write the reply:
+//   REBUILD [DBNAME] IDXNAME - queue rebuilding of the index
+//   SCAN [DBNAME]            - queue a bloat scan
+//   STATUS                   - show the running, queued and done jobs
+//   SHUTDOWN                 - stop after the running job
+void dmn_handle_client(int fd)
+{
+	struct timeval tv;
+	char buf[DMN_CMD_BUFSIZE];
+	char reply[DMN_CMD_BUFSIZE];
+	char *cmd, *arg1, *arg2, *save;
+	ssize_t n;
+	size_t len = 0;
+
+	// Don't let a silent client stall the shutdown:
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	while (len < sizeof(buf) - 1) {
+		n = read(fd, buf + len, sizeof(buf) - 1 - len);
+		if (n <= 0)
+			break;
+
+		len += n;
+		if (memchr(buf, '\n', len))
+			break;
+	}
+	buf[len] = '\0';
+
+	cmd = strtok_r(buf, " \t\r\n", &save);
+	arg1 = strtok_r(NULL, " \t\r\n", &save);
+	arg2 = strtok_r(NULL, " \t\r\n", &save);
+
+	if (!cmd) {
+		snprintf(reply, sizeof(reply), "ERROR empty command\n");
+	} else if (!strcmp(cmd, "REBUILD") && arg1) {
+		if (arg2)
+			dmn_enqueue(JOB_REBUILD, arg1, arg2, reply);
+		else
+			dmn_enqueue(JOB_REBUILD, glob_args.db_name, arg1, reply);
+	} else if (!strcmp(cmd, "SCAN")) {
+		dmn_enqueue(JOB_SCAN, arg1 ? arg1 : glob_args.db_name, "", reply);
+	} else if (!strcmp(cmd, "STATUS")) {
+		dmn_status(fd);
+		return;
+	} else if (!strcmp(cmd, "SHUTDOWN")) {
+		dmn_stop = 1;
+		snprintf(reply, sizeof(reply), "OK\n");
 	} else {
-		log_write(log_fp, ERR, "QUERY failed: %s\n",
-			  PQerrorMessage(conn));
-		PQclear(res);
-		return 0;
+		snprintf(reply, sizeof(reply), "ERROR unknown command\n");
 	}
+
+	if (write(fd, reply, strlen(reply)) < 0)
+		return;
 }
 
 
-// drop_idx(): drop an index
-int drop_idx(PGconn *conn, char *iname)
+// dmn_enqueue(): add a job to the queue unless the same
+// work is already queued or running; put the reply line
+// for the client into the reply buffer
+int dmn_enqueue(int type, char *db_name, char *idx_name, char *reply)
 {
-	PGresult *res;
-	char *drop_cmd;
-
-	// 24 is a length of "DROP INDEX CONCURRENTLY + 1 '\0'"
-	drop_cmd = (char*)malloc((25 + strlen(iname)) * sizeof(char));
+	struct dmn_job_t *job, *j;
 
-	strcpy(drop_cmd, "DROP INDEX CONCURRENTLY ");
-	strcat(drop_cmd, iname);
+	if (!is_safe_name(db_name) ||
+	    (type == JOB_REBUILD && !is_safe_name(idx_name))) {
+		snprintf(reply, DMN_CMD_BUFSIZE, "ERROR invalid name\n");
+		return FAIL;
+	}
 
-	log_write(log_fp, INF, "%s\n", drop_cmd);
+	pthread_mutex_lock(&dmn_lock);
+
+	// Conflicting work is a job of the same type on the same object:
+	for (j = dmn_running ? dmn_running : dmn_queue; j;
+	     j = (j == dmn_running ? dmn_queue : j->next)) {
+		if (j->type == type && !strcmp(j->db_name, db_name) &&
+		    !strcmp(j->idx_name, idx_name)) {
+			snprintf(reply, DMN_CMD_BUFSIZE,
+				 "CONFLICT job %d\n", j->id);
+			pthread_mutex_unlock(&dmn_lock);
+			return FAIL;
+		}
+	}
 
-	res = PQexec(conn, drop_cmd);
-	free(drop_cmd);
+	job = (struct dmn_job_t*)calloc(1, sizeof(struct dmn_job_t));
+	job->id = dmn_next_id++;
+	job->type = type;
+	job->state = JOB_QUEUED;
+	snprintf(job->db_name, sizeof(job->db_name), "%s", db_name);
+	snprintf(job->idx_name, sizeof(job->idx_name), "%s", idx_name);
+	job->queued = time(NULL);
 
-	if (PQresultStatus(res) == PGRES_COMMAND_OK) {
-		PQclear(res);
-		return 1;
-	} else {
-		log_write(log_fp, ERR, "QUERY failed: %s\n",
-			  PQerrorMessage(conn));
-		PQclear(res);
-		return 0;
+	if (!dmn_queue)
+		dmn_queue = job;
+	else {
+		for (j = dmn_queue; j->next; j = j->next)
+			;
+		j->next = job;
 	}
+
+	snprintf(reply, DMN_CMD_BUFSIZE, "QUEUED job %d\n", job->id);
+
+	pthread_cond_signal(&dmn_cond);
+	pthread_mutex_unlock(&dmn_lock);
+	return SUCCESS;
 }
 
 
-// rename_idx(): rename an index
-int rename_idx(PGconn *conn, char *tmp_iname, char *iname)
+// dmn_status(): write the state of jobs and the pool
+void dmn_status(int fd)
 {
-	PGresult *res;
-	char *rename_cmd;
+	static const char *types[] = {"REBUILD", "SCAN"};
+	static const char *states[] = {"queued", "running", "done", "failed"};
+	struct dmn_job_t *j;
+	struct dmn_pool_t *p;
+	FILE *out;
 
-	// 23 is a length of "ALTER INDEX RENAME TO " + 1 '\0'
-	rename_cmd = (char*)malloc((24 + strlen(tmp_iname) + strlen(iname))
-		                       * sizeof(char));
+	if ((out = fdopen(dup(fd), "w")) == NULL)
+		return;
 
-	strcpy(rename_cmd, "ALTER INDEX ");
-	strcat(rename_cmd, tmp_iname);
-	strcat(rename_cmd, " RENAME TO ");
-	strcat(rename_cmd, iname);
+	pthread_mutex_lock(&dmn_lock);
 
-	log_write(log_fp, INF, "%s\n", rename_cmd);
+	for (p = dmn_pool; p; p = p->next)
+		fprintf(out, "POOL %s %s\n", p->db_name,
+			PQstatus(p->conn) == CONNECTION_OK ? "ok" : "bad");
 
-	res = PQexec(conn, rename_cmd);
-	free(rename_cmd);
+	if ((j = dmn_running) != NULL)
+		fprintf(out, "JOB %d %s %s %s %s %lds\n", j->id, types[j->type],
+			j->db_name, j->idx_name, states[j->state],
+			(long)(time(NULL) - j->started));
 
-	if (PQresultStatus(res) == PGRES_COMMAND_OK) {
-		PQclear(res);
-		return 1;
-	} else {
-		log_write(log_fp, ERR, "QUERY failed: %s\n",
-			  PQerrorMessage(conn));
-		PQclear(res);
-		return 0;
-	}
+	for (j = dmn_queue; j; j = j->next)
+		fprintf(out, "JOB %d %s %s %s %s\n", j->id, types[j->type],
+			j->db_name, j->idx_name, states[j->state]);
+
+	for (j = dmn_history; j; j = j->next)
+		fprintf(out, "JOB %d %s %s %s %s %lds\n", j->id, types[j->type],
+			j->db_name, j->idx_name, states[j->state],
+			(long)(j->finished - j->started));
+
+	pthread_mutex_unlock(&dmn_lock);
+
+	fprintf(out, "END\n");
+	fclose(out);
 }
 
 
-// rebuild_idx(): the main function for rebuilding
-int rebuild_idx(PGconn *conn, char *iname)
+// dmn_worker(): take jobs from the queue and run them
+// one at a time, so conflicting work never overlaps
+void *dmn_worker(void *arg)
 {
-	unsigned prev_size, 
-		 next_size,
-		 diff;
-	int ret = SUCCESS;
-	char *indexdef = NULL;
-	char *idx_comment = NULL;
-	char *new_iname = NULL;
-	char *creat_cmd = NULL;
+	struct dmn_job_t *job, *j;
+	int n, ret;
 
-	log_write(log_fp, INF, "== Start to rebuild index ==: %s\n", iname);
+	(void)arg;
 
-	// Check the index is into the database:
-	ret = check_idx_name(conn, iname);
-	if (ret == FAIL) {
-		log_write(log_fp, ERR,
-			  "Index with specified index name not found. Exit\n");
-		return FAIL;
+	while (1) {
+		pthread_mutex_lock(&dmn_lock);
+		while (!dmn_queue && !dmn_stop)
+			pthread_cond_wait(&dmn_cond, &dmn_lock);
 
-	} else if (ret == 2) {
-		log_write(log_fp, ERR, "Index name is too long. Exit\n");
-		return FAIL;
-	}
+		if (dmn_stop) {
+			pthread_mutex_unlock(&dmn_lock);
+			break;
+		}
 
-	// Check index validity:
-	if (!check_idx_validity(conn, iname)) {
-		log_write(log_fp, ERR, "Index is invalid. Exit\n");
-		return FAIL;
+		job = dmn_queue;
+		dmn_queue = job->next;
+		job->next = NULL;
+		job->state = JOB_RUNNING;
+		job->started = time(NULL);
+		dmn_running = job;
+		pthread_mutex_unlock(&dmn_lock);
+
+		ret = dmn_run_job(job);
+
+		pthread_mutex_lock(&dmn_lock);
+		job->state = ret == SUCCESS ? JOB_DONE : JOB_FAILED;
+		job->finished = time(NULL);
+		dmn_running = NULL;
+
+		// Keep the last DMN_HISTORY jobs:
+		job->next = dmn_history;
+		dmn_history = job;
+		for (n = 1, j = dmn_history; j->next; j = j->next, n++) {
+			if (n == DMN_HISTORY) {
+				free(j->next);
+				j->next = NULL;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&dmn_lock);
 	}
 
-	// Get size of the current index for statistic:
-	prev_size = get_rel_size(conn, iname);
+	return NULL;
+}
 
-	// Get the index definition:
-	if ((indexdef = get_indexdef(conn, iname)) != NULL)
-		log_write(log_fp, INF, "Indexdef: %s\n", indexdef);
-	else {
-		log_write(log_fp, ERR, "Indexdef not found. Exit\n");
-		free(indexdef);
+
+// dmn_run_job(): run the job over the pooled connection
+// of its database; the monitoring connection of the pool
+// is found by get_mon_conn() from the main one
+int dmn_run_job(struct dmn_job_t *job)
+{
+	struct dmn_pool_t *pool;
+	int ret;
+
+	if ((pool = dmn_get_pool(job->db_name)) == NULL)
 		return FAIL;
+
+	if (job->type == JOB_REBUILD) {
+		log_write(log_fp, INF, "Daemon job %d: rebuild %s in %s\n",
+			  job->id, job->idx_name, job->db_name);
+		ret = rebuild_idx(pool->conn, job->idx_name);
+	} else {
+		log_write(log_fp, INF, "Daemon job %d: bloat scan of %s\n",
+			  job->id, job->db_name);
+		ret = dmn_bloat_scan(pool->conn, job->db_name);
 	}
 
-	// Get the index comment if it exists:
-	if ((idx_comment = get_idx_comment(conn, iname)) != NULL)
-		log_write(log_fp, INF,
-			  "Comment of index: '%s'\n", idx_comment);
-	else
-		log_write(log_fp, INF,
-			  "Comment of index not found. Continue\n");
+	return ret;
+}
 
-	// Make a new index name:
-	new_iname = make_new_iname(iname);
-	log_write(log_fp, INF, "Temporary new index name: %s\n", new_iname);
 
-	// Check the name for the new index:
-	if (check_idx_name(conn, new_iname) == 1) {
-		log_write(log_fp, ERR,
-			  "Index with name %s exists. Exit\n", new_iname);
-		free(indexdef);
-		free(idx_comment);
-		free(new_iname);
-		exit_nicely(conn);
-	}
+// dmn_conn_pool(): the pool entry of the main connection,
+// NULL if the connection is not pooled by the daemon
+struct dmn_pool_t *dmn_conn_pool(PGconn *conn)
+{
+	struct dmn_pool_t *pool;
 
-	// Make a creation command for the new index:
-	if ((creat_cmd = make_creat_cmd(new_iname, indexdef)) == NULL) {
-		log_write(log_fp, ERR,
-			  "Can not make creation command for new index. Exit\n");
-		free(indexdef);
-		free(idx_comment);
-		free(new_iname);
-		exit_nicely(conn);
+	pthread_mutex_lock(&dmn_lock);
+	for (pool = dmn_pool; pool; pool = pool->next)
+		if (pool->conn == conn)
+			break;
+	pthread_mutex_unlock(&dmn_lock);
+
+	return pool;
+}
+
+
+// dmn_save_queue(): write the jobs left in the queue on
+// shutdown to SOCKET.queue as control commands
+void dmn_save_queue(void)
+{
+	struct dmn_job_t *j;
+	char path[DMN_CMD_BUFSIZE];
+	FILE *fp;
+	int n = 0;
+
+	snprintf(path, sizeof(path), "%s.queue", glob_args.sock_path);
+
+	if (!dmn_queue) {
+		unlink(path);
+		return;
 	}
 
-	// Create a new index:
-	log_write(log_fp, INF, "Try to create new index\n");
+	if ((fp = fopen(path, "w")) == NULL) {
+		log_write(log_fp, ERR, "Could not save the queue to %s, "
+			  "queued jobs are lost\n", path);
+		return;
+	}
 
-	if (create_idx(conn, creat_cmd) == 1)
-		log_write(log_fp, INF, "Index has been created\n");
-	else {
-		log_write(log_fp, ERR, "Creation FAILED. Exit\n");
-		free(indexdef);
-		free(idx_comment);
-		free(new_iname);
-		exit_nicely(conn);
+	for (j = dmn_queue; j; j = j->next, n++) {
+		if (j->type == JOB_REBUILD)
+			fprintf(fp, "REBUILD %s %s\n", j->db_name, j->idx_name);
+		else
+			fprintf(fp, "SCAN %s\n", j->db_name);
 	}
-	free(creat_cmd);
 
-	// Check the new index validity:
-	if (!check_idx_validity(conn, new_iname)) {
-		log_write(log_fp, ERR,
-			  "New index is invalid. Drop it manually. Exit\n");
-		free(indexdef);
-		free(idx_comment);
-		free(new_iname);
-		exit_nicely(conn);
+	fclose(fp);
+	log_write(log_fp, INF, "%d queued job(s) saved to %s\n", n, path);
+}
+
+
+// dmn_load_queue(): queue the jobs saved by the
+// previous daemon again
+void dmn_load_queue(void)
+{
+	char path[DMN_CMD_BUFSIZE];
+	char line[DMN_CMD_BUFSIZE];
+	char reply[DMN_CMD_BUFSIZE];
+	char type[16], db_name[64], idx_name[64];
+	FILE *fp;
+	int n = 0;
+
+	snprintf(path, sizeof(path), "%s.queue", glob_args.sock_path);
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		idx_name[0] = '\0';
+		if (sscanf(line, "%15s %63s %63s", type, db_name, idx_name) < 2)
+			continue;
+
+		if (!strcmp(type, "REBUILD") && idx_name[0] &&
+		    dmn_enqueue(JOB_REBUILD, db_name, idx_name, reply) == SUCCESS)
+			n++;
+		else if (!strcmp(type, "SCAN") &&
+			 dmn_enqueue(JOB_SCAN, db_name, "", reply) == SUCCESS)
+			n++;
 	}
 
-	// Add the comment if it was:
-	if (idx_comment != NULL) {
-		if (add_comment(conn, new_iname, idx_comment))
-			log_write(log_fp, INF, "Comment has been added\n");
-		else 
-			log_write(log_fp, WRN, "Comment is not added\n");
+	fclose(fp);
+	unlink(path);
+
+	log_write(log_fp, INF, "%d saved job(s) queued again from %s\n",
+		  n, path);
+}
 
-		free(idx_comment);
+
+// dmn_get_pool(): return the pooled connection of the
+// database, open or reset it if needed
+struct dmn_pool_t *dmn_get_pool(char *db_name)
+{
+	struct dmn_pool_t *pool;
+	char *conn_pref = "dbname=";
+
+	pthread_mutex_lock(&dmn_lock);
+	for (pool = dmn_pool; pool; pool = pool->next)
+		if (!strcmp(pool->db_name, db_name))
+			break;
+	pthread_mutex_unlock(&dmn_lock);
+
+	if (!pool) {
+		pool = (struct dmn_pool_t*)calloc(1, sizeof(struct dmn_pool_t));
+		snprintf(pool->db_name, sizeof(pool->db_name), "%s", db_name);
+		pool->conninfo = (char*)malloc((strlen(conn_pref) +
+					       strlen(db_name) + 1) * sizeof(char));
+		strcpy(pool->conninfo, conn_pref);
+		strcat(pool->conninfo, db_name);
+		pool->conn = PQconnectdb(pool->conninfo);
+		pool->last_scan = time(NULL);
+
+		pthread_mutex_lock(&dmn_lock);
+		pool->next = dmn_pool;
+		dmn_pool = pool;
+		pthread_mutex_unlock(&dmn_lock);
+	} else if (PQstatus(pool->conn) != CONNECTION_OK) {
+		PQreset(pool->conn);
 	}
 
-	// Drop the index:
-	log_write(log_fp, INF, "Try to drop previous index\n");
+	if (PQstatus(pool->conn) != CONNECTION_OK) {
+		log_write(log_fp, ERR, "Connection to %s failed: %s\n",
+			  db_name, PQerrorMessage(pool->conn));
+		return NULL;
+	}
 
-	if (drop_idx(conn, iname) == 1) {
-		log_write(log_fp, INF, "Index has been dropped\n");
+	return pool;
+}
 
-		// Rename the index:
-		log_write(log_fp, INF,
-			  "Try to rename new index like previous\n");
 
-		// Set statement_timeout for RENAME:
-		set_statement_timeout(conn, glob_args.st_timeout);
+// dmn_bloat_scan(): write top of bloated indexes to the log,
+// the same estimate as -s (--schema, --top) in one shard
+int dmn_bloat_scan(PGconn *conn, char *db_name)
+{
+	struct bloat_heap_t heap = {0};
+	char size_buf[16], bloat_buf[16];
+	int i;
+
+	heap.max = glob_args.top;
+	heap.rows = (struct bloat_row_t*)malloc(heap.max *
+						sizeof(struct bloat_row_t));
+
+	if (run_bloat_shards(&conn, 1, &heap) != SUCCESS) {
+		log_write(log_fp, ERR, "Bloat scan of %s failed: %s\n",
+			  db_name, PQerrorMessage(conn));
+		free(heap.rows);
+		return FAIL;
+	}
 
-		if (rename_idx(conn, new_iname, iname)) {
-			log_write(log_fp, INF,
-				  "Index has been renamed\n");
+	qsort(heap.rows, heap.n, sizeof(struct bloat_row_t), cmp_bloat_row);
 
-			// Get size of the rebuilt index for statistic:
-			next_size = get_rel_size(conn, iname);
-			diff = prev_size - next_size;
-			log_write(log_fp, INF,
-				  "Prev idx size: %d, new idx size: %d, diff: %d\n",
-				  prev_size, next_size, diff);
-		} else {
-			log_write(log_fp, ERR, "Can not rename index\n");
-			ret = FAIL;
-		}
+	log_write(log_fp, INF, "Bloat scan of %s: %d index(es)\n",
+		  db_name, heap.n);
 
-	} else {
-		ret = FAIL;
-		log_write(log_fp, ERR, "Can not drop index\n");
+	for (i = 0; i < heap.n; i++) {
+		format_size(heap.rows[i].size, size_buf, sizeof(size_buf));
+		format_size(heap.rows[i].bloat, bloat_buf, sizeof(bloat_buf));
+		log_write(log_fp, INF, "Bloated: %s.%s (%s) size %s, "
+			  "bloat %s (%s%%)\n", heap.rows[i].nsp,
+			  heap.rows[i].idx, heap.rows[i].tbl, size_buf,
+			  bloat_buf, heap.rows[i].ratio);
 	}
 
-	set_statement_timeout(conn, "0");
+	free(heap.rows);
+	return SUCCESS;
+}
 
-	free(indexdef);
-	free(new_iname);
 
-	if (ret == SUCCESS)
-		log_write(log_fp, INF, "== Rebuilding is done ==\n");
-	else
-		log_write(log_fp, ERR, "== Rebuilding failed ==\n");
+// is_safe_name(): check the name passed over the socket
+// consists of identifier characters only
+int is_safe_name(char *name)
+{
+	char *p;
 
-	return ret;
+	if (!*name || strlen(name) > 63)
+		return 0;
+
+	for (p = name; *p; p++)
+		if (!isalnum((unsigned char)*p) && *p != '_' && *p != '$')
+			return 0;
+
+	return 1;
 }
 
 
@@ -911,6 +5398,29 @@ void print_now_time(void)
 }
 
 
+// sleep_ms: suspend execution for ms milliseconds
+void sleep_ms(int ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+
+	nanosleep(&ts, NULL);
+}
+
+
+// now_ms: monotonic clock in milliseconds
+double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
 // print_help: print a help message
 void print_help(int rcode)
 {
@@ -931,6 +5441,101 @@ void print_help(int rcode)
 		       "		Show not used indexes with size more than SIZE_THRESH in bytes\n"
 		       "  -l LOGFILE	Set up the LOGFILE (/tmp/pg_reindex.log by default)\n"
 		       "  -t SEC	Set up the statement_timeout in SEC (10 sec by default)\n"
+		       "  --watchdog	Cancel DROP/RENAME that blocks other sessions\n"
+		       "		and retry it later\n"
+		       "  --max-blocked NUM\n"
+		       "		Cancel when more than NUM sessions are blocked (3 by default)\n"
+		       "  --max-block-ms MS\n"
+		       "		Cancel when a session is blocked longer than MS (200 by default)\n"
+		       "  --swap-retries NUM\n"
+		       "		Retry a cancelled DROP/RENAME NUM times (5 by default)\n"
+		       "  --prewarm	Load the new index into shared buffers before\n"
+		       "		the swap (needs the pg_prewarm extension)\n"
+		       "  --prewarm-budget BYTES\n"
+		       "		Prewarm at most BYTES of the index (0 is unlimited)\n"
+		       "  --sample-bloat\n"
+		       "		Show bloat estimated from a random sample of leaf\n"
+		       "		pages (needs the pageinspect extension)\n"
+		       "  --sample-ci PCT\n"
+		       "		Stop sampling when the 95%% confidence interval is\n"
+		       "		within +/- PCT of the index size (2 by default)\n"
+		       "  --sample-max PCT\n"
+		       "		Read at most PCT of index pages (1 by default)\n"
+		       "  --verify	Check new btree indexes with bt_index_check() before\n"
+		       "		the swap (needs the amcheck extension); with -f the\n"
+		       "		check overlaps with building the next index\n"
+		       "  --probe SQL	Run SQL on a separate connection during rebuilding\n"
+		       "		and report its latency per phase against a baseline\n"
+		       "  --probe-rate NUM\n"
+		       "		Run the probe NUM times per second (10 by default)\n"
+		       "  --probe-baseline SEC\n"
+		       "		Measure the baseline for SEC before rebuilding (5 by default)\n"
+		       "  --auto-fillfactor\n"
+		       "		Choose fillfactor of rebuilt btree indexes by the write\n"
+		       "		rate of the table and the re-bloat history\n"
+		       "  --history FILE\n"
+		       "		Keep the rebuild history in FILE\n"
+		       "		(/tmp/pg_reindex.history by default)\n"
+		       "  --ts-hot TS	Move indexes read often to the tablespace TS\n"
+		       "  --ts-cold TS	Move rarely scanned indexes to the tablespace TS\n"
+		       "  --hot-scans NUM\n"
+		       "		An index with NUM scans/s is hot (100 by default)\n"
+		       "  --hot-reads NUM\n"
+		       "		An index with NUM blocks read/s is hot (10 by default)\n"
+		       "  --cold-scans NUM\n"
+		       "		An index with NUM scans/s or less is cold (0.01 by default)\n"
+		       "  --reconcile	Drop invalid and finish the swap of valid \"new_\"\n"
+		       "		indexes, before -r/-f or for the whole database\n"
+		       "  --standby CONNSTR\n"
+		       "		With -u, also count scans of the standby CONNSTR\n"
+		       "		(may be repeated up to 16 times)\n"
+		       "  --unused-days DAYS\n"
+		       "		With -u, show indexes unused for DAYS everywhere\n"
+		       "  --usage-file FILE\n"
+		       "		Keep scan counters across statistic resets in FILE\n"
+		       "		(/tmp/pg_reindex.usage by default)\n"
+		       "  --health	Print bloated, invalid, unused (larger than -u SIZE)\n"
+		       "		and \"new_\" indexes as one JSON document\n"
+		       "  --post-analyze\n"
+		       "		ANALYZE rebuilt tables after rebuilding\n"
+		       "  --vacuum-dead PCT\n"
+		       "		VACUUM ANALYZE instead if dead tuples are more than\n"
+		       "		PCT%% of the table (20 by default)\n"
+		       "  --analyze-host CONNSTR\n"
+		       "		Run -s, -i, -n, --sample-bloat, --health and\n"
+		       "		--min-gain estimates on the standby CONNSTR\n"
+		       "  --max-lag SEC	Discard results of a standby lagging more than\n"
+		       "		SEC (60 by default)\n"
+		       "  --min-gain SIZE|PCT%%\n"
+		       "		Skip indexes whose estimated gain is below SIZE\n"
+		       "		(bytes, kB, MB, GB, TB) or PCT percent of the\n"
+		       "		index size\n"
+		       "  --xact-policy warn|defer|terminate\n"
+		       "		What to do with transactions that stall the\n"
+		       "		index build (warn by default)\n"
+		       "  --xact-max-age SEC\n"
+		       "		Transactions older than SEC stall the build\n"
+		       "		(300 by default)\n"
+		       "  --defer-max SEC\n"
+		       "		Defer the build up to SEC (1800 by default)\n"
+		       "  --jobs N	Run the -s estimate on N connections\n"
+		       "		(1 by default)\n"
+		       "  --top N	Show N indexes by -s, --sample-bloat and\n"
+		       "		--health (50 by default)\n"
+		       "  --schema REGEX\n"
+		       "		Schemas of -s, --sample-bloat and --health\n"
+		       "		(^public$ by default)\n"
+		       "  --exclude-schema REGEX\n"
+		       "		Schemas not shown by -s, --sample-bloat and\n"
+		       "		--health\n"
+		       "  --observe SEC	Report block reads per scan of rebuilt\n"
+		       "		indexes SEC after the swap\n"
+		       "  --trace FILE	Write the timeline of rebuilding to FILE\n"
+		       "		(Chrome trace-event JSON)\n"
+		       "  --daemon SOCKET\n"
+		       "		Run as a daemon, accept jobs on the unix SOCKET\n"
+		       "  --scan-interval SEC\n"
+		       "		Log a bloat scan of pooled databases every SEC (daemon)\n"
 		       "  -v		Print version and exit\n"
 		       "  -h		Print this message and exit\n\n", PROG_NAME, PROG_NAME);
 	}
@@ -0,0 +1,100 @@
+#include <math.h>
+#include <string.h>
+#include "headers/stats.h"
+
+
+void run_stat_init(struct run_stat_t *st)
+{
+	st->n = 0;
+	st->mean = 0;
+	st->m2 = 0;
+}
+
+
+void run_stat_add(struct run_stat_t *st, double x)
+{
+	double delta;
+
+	st->n++;
+	delta = x - st->mean;
+	st->mean += delta / st->n;
+	st->m2 += delta * (x - st->mean);
+}
+
+
+// run_stat_var(): sample variance
+double run_stat_var(struct run_stat_t *st)
+{
+	if (st->n < 2)
+		return 0;
+
+	return st->m2 / (st->n - 1);
+}
+
+
+// run_stat_ci(): half-width of the 95% confidence
+// interval of the mean
+double run_stat_ci(struct run_stat_t *st)
+{
+	if (st->n < 2)
+		return HUGE_VAL;
+
+	return Z_95 * sqrt(run_stat_var(st) / st->n);
+}
+
+
+void hist_init(struct hist_t *h)
+{
+	memset(h, 0, sizeof(struct hist_t));
+}
+
+
+// hist_add(): count the value, values below 1
+// go to the first bucket
+void hist_add(struct hist_t *h, double x)
+{
+	int e, idx = 0;
+	double m;
+
+	if (x >= 1) {
+		m = frexp(x, &e);	// x = m * 2^e, m in [0.5, 1)
+		idx = (e - 1) * HIST_SUB + (int)((2 * m - 1) * HIST_SUB);
+
+		if (idx >= HIST_POW * HIST_SUB)
+			idx = HIST_POW * HIST_SUB - 1;
+	}
+
+	h->buckets[idx]++;
+	h->count++;
+
+	if (x > h->max)
+		h->max = x;
+}
+
+
+// hist_quantile(): upper bound of the bucket
+// holding the q-quantile (0 < q <= 1)
+double hist_quantile(struct hist_t *h, double q)
+{
+	long rank, seen = 0;
+	double ub;
+	int i;
+
+	if (!h->count)
+		return 0;
+
+	rank = (long)ceil(q * h->count);
+
+	for (i = 0; i < HIST_POW * HIST_SUB; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+
+	if (i == HIST_POW * HIST_SUB)
+		return h->max;
+
+	ub = ldexp(1 + (i % HIST_SUB + 1) / (double)HIST_SUB, i / HIST_SUB);
+
+	return ub < h->max ? ub : h->max;
+}
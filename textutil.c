@@ -0,0 +1,196 @@
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "headers/textutil.h"
+
+
+// make_new_iname(): make a temporary name for a new index
+char *make_new_iname(char *iname)
+{
+	char *new_iname;
+
+	new_iname = (char*)malloc(67 * sizeof(char));
+
+	strcpy(new_iname, "new_");
+	strcat(new_iname, iname);
+
+	return new_iname;
+}
+
+
+// make_creat_cmd: make a creation command
+char *make_creat_cmd(char *new_iname, char *idef)
+{
+	char *cmd = NULL;
+	char *on = NULL;
+
+	// The definition is "CREATE [UNIQUE] INDEX name ON ...":
+	if ((on = strstr(idef, " ON ")) == NULL)
+		return NULL;
+
+	// 34 is a length of "CREATE UNIQUE INDEX CONCURRENTLY " + 1 '\0'
+	cmd = (char*)malloc((34 + strlen(new_iname) + strlen(on))
+			    * sizeof(char));
+
+	if (!strncmp(idef, "CREATE UNIQUE ", 14))
+		strcpy(cmd, "CREATE UNIQUE INDEX CONCURRENTLY ");
+	else
+		strcpy(cmd, "CREATE INDEX CONCURRENTLY ");
+
+	strcat(cmd, new_iname);
+	strcat(cmd, on);
+
+	return cmd;
+}
+
+
+// set_fillfactor(): put the fillfactor into the WITH clause
+// of the creation command, the clause is added before the
+// WHERE of a partial index if there is none yet. The passed
+// command is freed, a new one is returned
+char *set_fillfactor(char *cmd, int ff)
+{
+	char *new_cmd, *p, *end;
+	char opt[24];
+	size_t pos;
+
+	new_cmd = (char*)malloc((strlen(cmd) + 32) * sizeof(char));
+
+	if ((p = strstr(cmd, "fillfactor=")) != NULL) {
+		// Replace the current value:
+		pos = p - cmd + strlen("fillfactor=");
+		end = cmd + pos;
+		// pg_get_indexdef() shows the value quoted, fillfactor='90':
+		if (*end == '\'')
+			end++;
+		while (isdigit((unsigned char)*end))
+			end++;
+		if (*end == '\'')
+			end++;
+		snprintf(opt, sizeof(opt), "%d", ff);
+	} else if ((p = strstr(cmd, " WITH (")) != NULL) {
+		// Add to other storage parameters:
+		pos = p - cmd + strlen(" WITH (");
+		end = cmd + pos;
+		snprintf(opt, sizeof(opt), "fillfactor=%d, ", ff);
+	} else {
+		// Add the clause:
+		p = strstr(cmd, " WHERE ");
+		pos = p ? (size_t)(p - cmd) : strlen(cmd);
+		end = cmd + pos;
+		snprintf(opt, sizeof(opt), " WITH (fillfactor=%d)", ff);
+	}
+
+	memcpy(new_cmd, cmd, pos);
+	strcpy(new_cmd + pos, opt);
+	strcat(new_cmd, end);
+
+	free(cmd);
+	return new_cmd;
+}
+
+
+// find_top_where(): find the WHERE of a partial index in
+// the definition, outside of parentheses, string literals
+// and quoted identifiers; NULL if the index is not partial
+char *find_top_where(char *def)
+{
+	char quote = 0;
+	int depth = 0;
+	char *p;
+
+	for (p = def; *p; p++) {
+		// A doubled quote closes and opens the literal again:
+		if (quote) {
+			if (*p == quote)
+				quote = 0;
+		} else if (*p == '\'' || *p == '"')
+			quote = *p;
+		else if (*p == '(')
+			depth++;
+		else if (*p == ')')
+			depth--;
+		else if (depth == 0 && !strncmp(p, " WHERE ", 7))
+			return p;
+	}
+
+	return NULL;
+}
+
+
+// parse_idx_line(): check a line of the index list read by
+// fgets(), the trailing newline is cut off. Lines that do not
+// start with a letter (comments, blank lines) are skipped
+int parse_idx_line(char *str)
+{
+	char *ptr = NULL;
+
+	if (!isalpha((unsigned char)str[0]))
+		return 0;
+
+	ptr = strchr(str, '\n');
+	if (ptr != NULL) *ptr = '\0';
+
+	return 1;
+}
+
+
+// format_size: format bytes like pg_size_pretty()
+void format_size(long bytes, char *buf, size_t len)
+{
+	static const char *units[] = {"bytes", "kB", "MB", "GB", "TB"};
+	long size = bytes;
+	int u = 0;
+
+	while (u < 4 && (size >= 10240 || size <= -10240)) {
+		size = (size + (size < 0 ? -512 : 512)) / 1024;
+		u++;
+	}
+
+	snprintf(buf, len, "%ld %s", size, units[u]);
+}
+
+
+// parse_size(): parse bytes with an optional unit of
+// pg_size_pretty(), e.g. "1GB" or "500 kB", 0 if not a size
+int parse_size(const char *str, long *bytes)
+{
+	static const char *units[] = {"bytes", "kB", "MB", "GB", "TB"};
+	char *end;
+	long size;
+	int u;
+
+	if (!isdigit((unsigned char)*str))
+		return 0;
+
+	errno = 0;
+	size = strtol(str, &end, 10);
+	if (errno == ERANGE)
+		return 0;
+	while (isspace((unsigned char)*end))
+		end++;
+
+	if (*end == '\0') {
+		*bytes = size;
+		return 1;
+	}
+
+	for (u = 0; u < 5; u++)
+		if (strcasecmp(end, units[u]) == 0)
+			break;
+	if (u == 5)
+		return 0;
+
+	for (; u > 0; u--) {
+		if (size > LONG_MAX / 1024)
+			return 0;
+		size *= 1024;
+	}
+
+	*bytes = size;
+	return 1;
+}
@@ -0,0 +1,140 @@
+#include <pthread.h>
+#include <stdio.h>
+#include "headers/trace.h"
+
+static FILE *trace_fp = NULL;
+static int trace_events = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// trace_open(): start the trace file, it is a JSON array
+// of events, so a trace cut by a crash is still readable
+int trace_open(const char *path)
+{
+	if ((trace_fp = fopen(path, "w")) == NULL)
+		return 0;
+
+	fprintf(trace_fp, "[");
+	trace_events = 0;
+	return 1;
+}
+
+
+void trace_close(void)
+{
+	pthread_mutex_lock(&trace_lock);
+
+	if (trace_fp) {
+		fprintf(trace_fp, "\n]\n");
+		fclose(trace_fp);
+		trace_fp = NULL;
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+}
+
+
+int trace_enabled(void)
+{
+	return trace_fp != NULL;
+}
+
+
+// trace_start_event(): write the common fields, the caller
+// holds the lock and closes the event object
+static void trace_start_event(int tid, const char *ph, const char *name,
+			      const char *cat)
+{
+	fprintf(trace_fp, "%s\n{\"pid\": %d, \"tid\": %d, \"ph\": \"%s\", \"name\": ",
+		trace_events++ ? "," : "", TRACE_PID, tid, ph);
+	print_json_str(trace_fp, name);
+
+	if (cat) {
+		fprintf(trace_fp, ", \"cat\": ");
+		print_json_str(trace_fp, cat);
+	}
+}
+
+
+static void trace_write_arg(const char *arg_name, const char *arg_val)
+{
+	if (!arg_name)
+		return;
+
+	fprintf(trace_fp, ", \"args\": {");
+	print_json_str(trace_fp, arg_name);
+	fprintf(trace_fp, ": ");
+	print_json_str(trace_fp, arg_val ? arg_val : "");
+	fprintf(trace_fp, "}");
+}
+
+
+// trace_track_name(): name the track in the viewer
+void trace_track_name(int tid, const char *name)
+{
+	pthread_mutex_lock(&trace_lock);
+
+	if (trace_fp) {
+		trace_start_event(tid, "M", "thread_name", NULL);
+		trace_write_arg("name", name);
+		fprintf(trace_fp, "}");
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+}
+
+
+// trace_complete(): the span of the finished operation
+void trace_complete(int tid, const char *name, const char *cat,
+		    double start_ms, double dur_ms,
+		    const char *arg_name, const char *arg_val)
+{
+	pthread_mutex_lock(&trace_lock);
+
+	if (trace_fp) {
+		trace_start_event(tid, "X", name, cat);
+		fprintf(trace_fp, ", \"ts\": %.0f, \"dur\": %.0f",
+			start_ms * 1000, dur_ms * 1000);
+		trace_write_arg(arg_name, arg_val);
+		fprintf(trace_fp, "}");
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+}
+
+
+// trace_instant(): the event at a moment on the track
+void trace_instant(int tid, const char *name, const char *cat,
+		   double ts_ms, const char *arg_name, const char *arg_val)
+{
+	pthread_mutex_lock(&trace_lock);
+
+	if (trace_fp) {
+		trace_start_event(tid, "i", name, cat);
+		fprintf(trace_fp, ", \"s\": \"t\", \"ts\": %.0f", ts_ms * 1000);
+		trace_write_arg(arg_name, arg_val);
+		fprintf(trace_fp, "}");
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+}
+
+
+// print_json_str(): print the string as a JSON string
+void print_json_str(FILE *fp, const char *str)
+{
+	const unsigned char *p;
+
+	fputc('"', fp);
+
+	for (p = (const unsigned char*)str; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			fprintf(fp, "\\%c", *p);
+		else if (*p < 0x20)
+			fprintf(fp, "\\u%04x", *p);
+		else
+			fputc(*p, fp);
+	}
+
+	fputc('"', fp);
+}